@@ -26,6 +26,41 @@
 #include <limits>
 #include <random>
 #include <typeinfo>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <system_error>
+#include <new>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <stdexcept>
+#include <exception>
+#include <functional>
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SNSE_X86_SIMD
+#endif
 
 using namespace std;
 
@@ -34,227 +69,535 @@ using namespace std;
 */
 
 /*
- * The number of day of utilization of products by firms i (n_i).
- * The number of days to adjust the inventory size (tau)
+ * Settings of the run
 */
-
-/*
- * Model parameters
-*/
-int n;
-int tau;
-int t;
-int disaster;
-int HelpFirms;
-double GammaMin;
-double GammaMax;
-double NumberDamagedFirms;
-double DamageMagnitude;
-double LimitSolvencyRatio;
-int StartRecover; //Number of days before starting recovery
-int LoanMaturity; //The maturity of all loans in number of days
-int LTLoanMaturity;
-int WithPayment; //Model with payment from customers to suppliers or not
-int ShortLoans; //Model with short term loans given by banks to firms or not
-int LTLoansModel; //Model with short term loans given by banks to firms or not
-int ShortInterestRate; //Model with 0 short term interest rate or not
-int LimitToDefault; //Number of day without payment before declaring loan default
-int BankRiskManager; //If 1 the bank is a risk manager; 0: the bank has no risk policy in case of disaster; Give priority of the economic recovery
-int location_of_disaster; //35: Tokyo, 52: Kyoto, 53: Osaka, 54: Hyogo
-int sector_of_disaster ;
-int community_of_disaster;
-int DisasterScenario; //0: Random Selection from the whole network; 1: Random selection from one prefecture ; 2: Random selection from one sector; 3: Random selection from one community
 int SimTime = 365; //Size of the simulation; e.g. 365 days: 1 year.
 int GlobalSim =100; //Number of trial with different random seeds. If supercomputer is used, it is to make it parallel: simulations are independent.
-
-unordered_map<int, int > DaysH;
+int ReplicationThreads = 0; //Number of replications simulated at the same time; 0: one per core. With more than one, each replication runs its steps on a single thread.
+uint64_t MasterSeed = 0; //Seed of all random numbers; 0: taken from the clock. The seed is printed at the start, so a run can be repeated.
+int RerunReplication = -1; //If 0 or more, only this replication of the master seed is simulated
 
 /*
- * two unordered maps for the weighted production network
- * 1- The out links of each firm: the list of customers j of each firm i, where each customer j is defined by his attributes: sector, location, number of employee, weight (A_ji)
- * 2- The in links of each firm: the list of suppliers j of each firm i, where each supplier j is defined by his attributes: sector, location, number of employee, weight (A_ij)
+ * Input files, in InputDirectory
 */
+std::string InputDirectory = "Data/"; //Ends with a separator
+const char* const LinksFile = "ToyTable1.txt";
+const char* const ClustersFile = "FirmClusters.txt";
+const char* const ProfitFile = "toyProfitToSales.txt";
+const char* const LocationFile = "toyGeography.txt";
+const char* const SectorFile = "toySector.txt";
+const char* const CommunityFile = "toyCommunity.txt";
+const char* const FirmBankFile = "FBToy.txt";
+const char* const BalanceSheetFile = "BSToy.txt";
+const char* const ConsumptionFile = "CToy1.txt";
+const char* const ProductionFile = "ToyPini.txt";
+const char* const SectorListFile = "ToyKJ.txt";
+const int InputFileCount = 11;
+const char* const InputFiles[InputFileCount] = {LinksFile, ClustersFile, ProfitFile, LocationFile, SectorFile, CommunityFile, FirmBankFile, BalanceSheetFile, ConsumptionFile, ProductionFile, SectorListFile};
+inline std::string InputPath(const char* file) {return InputDirectory + file;}
+int CheckpointEvery = 0; //Each replication saves its state every CheckpointEvery steps and at the end; 0: no checkpoint
+std::string CheckpointPrefix = "Results/Checkpoint_"; //Checkpoint of the replication r: CheckpointPrefix + r + ".bin"
+bool TextResults = 1; //Write the results in text files
+bool BinaryResults = 1; //Write the results in the binary file Results/Series.bin
+std::string SweepFile = "Data/Sweep.txt"; //Parameter sets of the sweep mode
+std::string SweepResults = "Results/Sweep.txt"; //One line per parameter set and replication
+std::string CalibrationTarget = "Data/IIP.txt"; //Observed IIP of the calibration mode: day; IIP divided by its level before the shock
+int CalibrationLoss = 0; //Loss of the calibration: 0: sum of squared differences; 1: sum of absolute differences
+std::string CalibrationResults = "Results/Calibration.txt"; //One line per candidate
+int ValueAddedHistory = 0; //Per-firm value added: 0: not kept, only the GDP; 1: one day out of ValueAddedStride, kept in memory; 2: the last ValueAddedWindow days, kept in memory; 3: one day out of ValueAddedStride, streamed to the file
+int ValueAddedStride = 1; //The days 0, ValueAddedStride, 2*ValueAddedStride... are kept
+int ValueAddedWindow = 30;
+std::string ValueAddedPrefix = "Results/ValueAdded_"; //Panel of the replication r: ValueAddedPrefix + r + ".bin", written at the end of the replication, or during it with 3
+bool RawSeries = 0; //Also write the series of all replications side by side (Full*.txt); they are then kept in memory until the end of the run
+double EquilibriumTolerance = 0; //Relative tolerance of the equilibrium: once reached, the remaining days are filled without simulation; 0: replications are always simulated until SimTime
+int EquilibriumWindow = 30; //Number of consecutive steps within the tolerance of the start of the window before the equilibrium is declared
+bool ActiveSetStepping = 1; //Skip the firms whose inputs didn't change since the previous step; 0: all firms are computed at each step
+std::string NetworkCache = "Data/Network.cache"; //Compiled network, used while it matches the input files; empty: the input files are always parsed
+std::string ProfileReport = "Results/Profile.json"; //Time and calls of the phases of the steps and counts of the events, summed over the replications; empty: no report
+std::string ProfileTrace = ""; //Chrome trace of the phases of each step, e.g. Results/Trace.json, one row per replication; empty: no trace
+bool StepLog = 0; //Print "step ; t ; GDP" after each step; otherwise one line per finished replication
 
-unordered_map<int, unordered_map<int, vector<double> > > OutPutFirmHoH; //Aji
+/*
+ * Synthetic economies and benchmark
+*/
+uint64_t SyntheticSeed = 1; //Seed of the synthetic economies: a number of firms and a seed always give the same files
+double SyntheticExponent = 2.3; //Exponent of the power law of the degrees of the supply network
+int SyntheticMinDegree = 2; //Smallest number of customers drawn for a supplier
+int SyntheticSectors = 100;
+int SyntheticPrefectures = 47;
+int SyntheticCommunities = 50;
+int SyntheticFirmsPerBank = 2000; //The number of banks grows with the number of firms; at least 3 banks
+std::string BenchmarkDirectory = "Data/Synthetic/"; //The economy of n firms is in BenchmarkDirectory + n; it is generated if it isn't there
+vector<int> BenchmarkSizes = {1000, 10000, 100000, 1000000}; //Numbers of firms of the benchmark, up to 10^7
+int BenchmarkSteps = 30; //Steps of the replication simulated at each size
+std::string BenchmarkResults = "Results/Benchmark.json";
+vector<int> MemorySteps = {1, 30, 100, 365}; //Steps of the memory report of a replication, after step 0
+std::string MemoryResults = "Results/Memory.txt";
+
+mutex ConsoleMutex; //The replications running at the same time print their lines one at a time
 
-unordered_map<int, unordered_map<int, vector<double> > > InPutFirmHoH; //Aij
 
 /*
- * Each firm i produces at each step Y_{i,t}.
- * The effective realized production is saved in an unordered map.
+ * The columns of the firm state are aligned on a cache line.
 */
 
-unordered_map<int, double > ProductionIniH; //Pini in the paper notation
+const size_t CacheLine = 64;
+
+template <typename T>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t count)
+	{
+		void* p = 0;
+#ifdef _WIN32
+		p = _aligned_malloc(count*sizeof(T), CacheLine);
+#else
+		if (posix_memalign(&p, CacheLine, count*sizeof(T)) != 0){p = 0;}
+#endif
+		if (p == 0){throw std::bad_alloc();}
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, size_t)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {return true;}
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {return false;}
 
-unordered_map<int, double > CurrentProductionH; //Pact in the paper notation
+template <typename T> using Column = vector<T, AlignedAllocator<T> >;
 
 /*
- * The final consumption (goods sold to households) is kept constant as supposed in Inoue and Todo (2018): C_i
+ * The weighted production network is kept in compressed sparse row (CSR) form.
+ * Firm IDs are remapped once at load to dense indices 0..N-1: FirmIDs[i] is the ID of firm i, sorted by ID.
+ * The links of firm i are the positions Start[i] to Start[i+1]-1 of the other arrays:
+ * 1- The out links of each firm: the customers j of each firm i with the weight (A_ji), its inverse and the sector of the customer
+ * 2- The in links of each firm: the suppliers j of each firm i with the weight (A_ij), its inverse and the sector of the supplier
+ * Twin gives the position of the same link in the other direction (out link <-> in link).
 */
 
-unordered_map<int, double > cVectorH; //Ci
+struct CSRLinks
+{
+	vector<int> Start; //N+1 offsets
+	vector<int> Firm; //Dense index of the customer (out links) or of the supplier (in links)
+	vector<double> Weight; //A_ji or A_ij
+	vector<double> InvWeight; //1/A_ji or 1/A_ij
+	vector<int> Sector; //Sector of the customer (out links) or of the supplier (in links)
+	vector<int> Twin; //Position of the same link in the other direction
+};
 
 /*
- * At each step t, each firm i realizes a list of orders from its suppliers j denoted by O_{ij,t}^{*} as in Inoue and Todo (2018)
- * All orders are saved in an unordered map
- * All desired orders are also saved for each firm i (total desires addressed to all of each suppliers)
+ * The data of the firms which do not change during a simulation, read from the files and kept as columns indexed by the dense firm index.
+ * Firms missing from an input file keep the default value 0 in the corresponding column.
 */
 
-unordered_map<int, unordered_map<int, double > > rOrdersHoH; //O_{ij,t}^{*}
-
-unordered_map<int, double > dOrdersH;
+struct FirmProfile
+{
+	/*
+	 * The initial production Pini and the final consumption (goods sold to households) kept constant as supposed in Inoue and Todo (2018): C_i
+	*/
+	Column<double> Pini; //Pini in the paper notation
+	Column<double> C; //Ci
+	Column<double> ProfitToSales;
+	Column<double> TotalOutput;
+	Column<double> TotalInput;
 
-unordered_map<int, double > GROrdersH; //Save the sum of O_{ij,t}^{*} for each firm i
+	/*
+	 * Initial firm BS: Deposit; OA; Loan; Equity; OL
+	*/
+	Column<double> Deposit;
+	Column<double> OA;
+	Column<double> Loan;
+	Column<double> Equity;
+	Column<double> OL;
 
-/*
- * Each supplier i receives desired orders from its client.
- * The sum of the desired orders is the received demand.
- * Another data structure for the received demand firm by firm: for each supplier, we note all orders client by client.
-*/
+	/*
+	 * Network statistics
+	*/
+	Column<double> Clusters;
+	Column<double> Knn;
 
-unordered_map<int, double > rcDemandVectorH; //D_{i,t}
+	Column<int> IOSector; //Sector of the list of firms (190 sector of IO table)
+	Column<int> Sector; //Sector used to select damaged firms
+	Column<int> Location; //Prefecture
+	Column<int> Community;
+	Column<char> Active; //0: firms which have no Pini no Ci; They don't produce, they only submit constant orders equal to initial input
 
-unordered_map<int, unordered_map <int, double > > rcDemandFirmLevelH; //D_{ij,t}
+	void Resize(int N)
+	{
+		for (Column<double>* column : {&Pini, &C, &ProfitToSales, &TotalOutput, &TotalInput, &Deposit, &OA, &Loan, &Equity, &OL, &Clusters, &Knn})
+		{
+			column->assign(N, 0.0);
+		}
+		for (Column<int>* column : {&IOSector, &Sector, &Location, &Community})
+		{
+			column->assign(N, 0);
+		}
+		Active.assign(N, 0);
+	}
+};
 
 /*
- * Each supplier i realizes based on its production the desired orders received from its client.
- * The sum of the realized orders is the realized demand.
+ * Each firm i holds inventory by sector for the production: the sectors of the suppliers of firm i are the positions Start[i] to Start[i+1]-1 of the packed arrays, sorted by sector.
+ * For seek of utility, we use Aij as the total of initial input for each firm by sector
 */
 
-unordered_map<int, double> rzDemandVectorH; //D_{i,t}^{*}
+struct SectorLayout
+{
+	vector<int> Start; //N+1 offsets
+	vector<int> Sector; //Sector of each position
+	vector<int> Slot; //Position of the sector of the supplier of each in link
+	Column<double> Aij; //Sum_{sector}(Aij)
+};
 
 /*
- * Each firm i holds inventory from different of its suppliers j.
- * The firm level inventory evolution is saved in an unordered map.
- * Inventory is measured by sector for the production.
- * Inventory evolves by sector too, where values are saved in another unordered map.
- * For seek of utility, we use AijSectorHoH as the total of initial input for each firm by sector
+ * Firm - Bank network
+ * Each firm i has one account per bank: the accounts of firm i are the positions Start[i] to Start[i+1]-1, sorted by bank ID.
 */
 
-unordered_map<int, unordered_map<int, vector<double> > > fInventoryHoH; //Sij
-
-unordered_map<int, unordered_map<int, double> > AccfInventoryHoH; //employed during trading only to calculate the added new inventory
+struct AccountLayout
+{
+	vector<int> Start; //N+1 offsets
+	vector<int> Bank; //ID of the bank of each account
+	vector<double> Balance; //Loan; Deposit of each account at t = 0: two values per account
+	vector<int> Banks; //IDs of all banks, sorted
+};
 
-unordered_map<int, unordered_map<int, double > > sInventoryHoH; //Sum_{sector}(Sij)
+/*
+ * The firms of each group (prefecture, sector or community), in the positions Start[g] to Start[g+1]-1 of Firm; the keys of the groups are sorted.
+*/
 
-unordered_map<int, unordered_map<int, double > > AccsInventoryHoH; //employed during trading only to calculate the added new inventory
+struct FirmGroups
+{
+	vector<int> Key;
+	vector<int> Start;
+	vector<int> Firm; //Dense indices
 
-unordered_map<int, unordered_map<int, double > > AijSectorHoH; //Sum_{sector}(Aij)
+	void Build(const Column<int>& key_of_firm)
+	{
+		int N = key_of_firm.size();
+		Firm.resize(N);
+		for (int i = 0; i < N; i++){Firm[i] = i;}
+		std::stable_sort(Firm.begin(), Firm.end(), [&](int a, int b) {return key_of_firm[a] < key_of_firm[b];});
+		Key.clear();
+		Start.clear();
+		for (int k = 0; k < N; k++)
+		{
+			if (Key.empty() or (Key.back() != key_of_firm[Firm[k]]))
+			{
+				Key.push_back(key_of_firm[Firm[k]]);
+				Start.push_back(k);
+			}
+		}
+		Start.push_back(N);
+	}
 
-unordered_map<int, double > fUsedInventoryH; //used inventory for production
+	/*This function returns the firms of the group key and their number; 0 firms if the group doesn't exist*/
+	const int* Find(int key, int& size) const
+	{
+		vector<int>::const_iterator itr = std::lower_bound(Key.begin(), Key.end(), key);
+		size = 0;
+		if ((itr == Key.end()) or (*itr != key)){return 0;}
+		int g = itr - Key.begin();
+		size = Start[g+1] - Start[g];
+		return &Firm[Start[g]];
+	}
+};
 
 /*
- * Each firm has its own value added as an economic performance indicator
+ * The network is loaded once and shared by all replications: nothing in it is modified during a simulation.
 */
 
-unordered_map<int, vector<double> > ValueAddedVectorH;
+struct MemoryReport;
 
-/*
- * List of damaged firms randomly selected
- * List of all firms
-*/
+struct Network
+{
+	vector<int> FirmIDs; //Dense index -> firm ID
+	CSRLinks OutLinks; //Aji
+	CSRLinks InLinks; //Aij
+	vector<int> LinkS; //Supplier of each line of the links file (dense index)
+	vector<int> LinkC; //Customer of each line of the links file (dense index)
+	FirmProfile Profile;
+	SectorLayout Sectors;
+	AccountLayout Accounts;
+
+	/*
+	 * The firms of each prefecture, sector and community, to select the damaged firms of a disaster scenario
+	*/
+	FirmGroups LocationFirms;
+	FirmGroups SectorFirms;
+	FirmGroups CommunityFirms;
+
+	int FirmIndex(int ID) const;
+	void Load();
+	bool LoadCache(const std::string& path);
+	void SaveCache(const std::string& path);
+	template <typename Archive> void Arrays(Archive& archive);
+	void Memory(MemoryReport& report) const;
+};
 
-set <int> DamagedFirmsH; //List of damaged firms
-set <int> ListSupplier; //List of Suppliers
-set <int> ListCustomer; //List of customers
-set <int> Firms; //List of all firms
-set <int> InactiveFirms; //List of firms which have no Pini no Ci; They don't produce, they only submit constant orders equal to initial input
-unordered_map<int,int> ListofFirmsH; //Firm ID, sector (190 sector of IO table)
 /*
- * The factor Delta of loosing production capacity
+ * The state of the firms is a struct of arrays: one contiguous column per variable, indexed by the dense firm index.
 */
 
-unordered_map<int, double > DeltaH;
-unordered_map<int, double > RecoveryH;
-unordered_map<int, double > LTLoansH;
-unordered_map<int, double > ProfitToSalesH;
+struct FirmState
+{
+	/*
+	 * Each firm i produces at each step Y_{i,t}.
+	*/
+	Column<double> Pact; //Pact in the paper notation
+
+	/*
+	 * At each step t, each firm i realizes a list of orders from its suppliers j denoted by O_{ij,t}^{*} as in Inoue and Todo (2018)
+	 * The desired orders are saved for each firm i (total desires addressed to all of its suppliers)
+	 * Each supplier i receives desired orders from its clients: the sum of the desired orders is the received demand.
+	 * Each supplier i realizes based on its production the desired orders received from its clients: the sum of the realized orders is the realized demand.
+	*/
+	Column<double> dOrders;
+	Column<double> GROrders; //Sum of O_{ij,t}^{*} for each firm i
+	Column<double> rcDemand; //D_{i,t}
+	Column<double> rzDemand; //D_{i,t}^{*}
+	Column<double> fUsedInventory; //used inventory for production
+	Column<int> Days; //Number of days of inventory n_i
+
+	/*
+	 * The factor Delta of loosing production capacity
+	*/
+	Column<double> Delta;
+	Column<double> Recovery;
+	Column<double> LTLoans;
 
-vector< double > GDP;
-double ValueGDP;
-unordered_map<int, double > Total_Output;
-unordered_map<int, double > Total_Input;
+	/*
+	 * Firm BS: Deposit; Loan; Equity
+	 * Define the profit of the firm:
+	 * 1- Expenses: This column is update each step in the payment function
+	 * 2- For the revenue, we can use the rzDemand
+	*/
+	Column<double> Deposit;
+	Column<double> Loan;
+	Column<double> Equity;
+	Column<double> Expenses;
+	Column<int> LoanFlag; //Values: 2 don't need loans; 1: Need and got loans; 0: Need but didn't get loans
+	Column<int> NoLoans; //How many time the firm could not take loans due to bank risk policy: Value 0 is the default.
+	Column<char> Damaged;
+
+	void Resize(int N)
+	{
+		for (Column<double>* column : {&Pact, &dOrders, &GROrders, &rcDemand, &rzDemand, &fUsedInventory, &Delta, &Recovery, &LTLoans,
+				&Deposit, &Loan, &Equity, &Expenses})
+		{
+			column->assign(N, 0.0);
+		}
+		for (Column<int>* column : {&Days, &LoanFlag, &NoLoans})
+		{
+			column->assign(N, 0);
+		}
+		Damaged.assign(N, 0);
+	}
+};
 
 /*
- * Firm BS
- * Firm - Bank network
+ * The inventory of each firm by sector, in the positions of the sector layout.
 */
 
-unordered_map<int, vector < double > > FirmBSH; // ID Firm; Deposit; OA; Loan; Equity; OL
-unordered_map<int, unordered_map<int, vector < double > > > FirmBankHoH; //ID Firm; ID Bank; Loan; Deposit
-
 /*
- * CurrentLoansHoH: This structure contains the whole current loans given to Firm i by Bank j
- * LoanKeyHoH: This structure contains the keys for the unordered map CurrentLoansHoH
- * LoanFlagH: unordered map containing a bool flag indicating if the firm got the loan or not
- * PayByLoanHoH: unordered map containing the amount of loan taken by the firm from each of its banks. These amounts are used first to pay suppliers
- * NPLHoH: unordered map containing the non-performing loans for each firm with its banks (bank by bank)
+ * Each firm has its own value added as an economic performance indicator; its history is only kept on demand (ValueAddedHistory).
+ * The kept days are rows of N values in the order of the dense firm indices; the inactive firms have 0.
+ * In the ring (2), the row of a new day replaces the oldest row once ValueAddedWindow rows are kept.
 */
 
-unordered_map<int, unordered_map<int, unordered_map<int, vector < double > > > > CurrentLoansHoH; //The borrowed capital; The interest rate; The periodic amortization; the current period
-unordered_map<int, unordered_map<int, int > > LoanKeyHoH;
-unordered_map<int, int > LoanFlagH; //Values: 2 don't need loans; 1: Need and got loans; 0: Need but didn't get loans
-unordered_map<int, unordered_map<int, double > > PayByLoanHoH;
-unordered_map<int, unordered_map<int, double > > NPLHoH;
-unordered_map<int, int > FirmsNoLoansH; //List of firms which could not take loans due to bank risk policy; How many time they were rejected: Value 0 is the default.
+struct FirmPanel
+{
+	Column<double> Current; //Value added of each firm at the last step
+	Column<double> Values; //Kept rows, one after another
+	vector<int> Days; //Day of each kept row
+	int Next = 0; //Row of the next day in the ring
+	int64_t Written = 0; //Rows written in the file
+	std::shared_ptr<fstream> File; //Panel file of the streamed rows (3)
+};
+
+struct SectorInventory
+{
+	Column<double> Inventory; //Sum_{sector}(Sij)
+	Column<double> AccInventory; //employed during trading only to calculate the added new inventory
+};
 
 /*
- * Save financial statistics
+ * The active set of a step: the firms whose inputs changed since the previous step.
+ * The orders, the received demand, the production and the trading of a firm only depend on a few inputs; when none of them changed,
+ * the results of the previous step are still exact and the firm is skipped: its orders and demand are kept and its deliveries are replayed.
+ * The changes are tested on the bits of the values, so a skipped firm gives the same result as a computed one.
+ * The balance sheets, the payments and the inventories are updated for all firms at each step.
 */
-vector< double > NPLH;
-double GNPL;
 
-vector< double > DepositH;
-double GDeposit;
+struct ActiveSet
+{
+	Column<char> OrdersInput; //The realized demand or the inventories of the firm changed at the previous step
+	Column<char> OrdersChanged; //The desired orders of the firm changed in this step
+	Column<char> DemandChanged; //The received demand of the firm changed in this step
+	Column<char> ProductionInput; //The inventories of the sectors of the firm changed at the previous step
+	Column<char> ProductionChanged; //The production of the firm changed in this step
+	Column<double> LastRzDemand; //Realized demand at the end of the previous step
+	Column<double> Sales; //Realized demand after the trading, before the returned goods
+	vector<double> Delivered; //Goods delivered through each in link at the last trading
+	bool Full; //All firms are computed in the next step
+
+	void Resize(int N, int E)
+	{
+		for (Column<char>* column : {&OrdersInput, &OrdersChanged, &DemandChanged, &ProductionInput, &ProductionChanged})
+		{
+			column->assign(N, 1);
+		}
+		LastRzDemand.assign(N, 0.0);
+		Sales.assign(N, 0.0);
+		Delivered.assign(E, 0.0);
+		Full = 1;
+	}
+};
+
+/*The values are compared bit by bit: -0 differs from 0 and a NaN equals itself*/
+inline bool Same(double x, double y)
+{
+	return memcmp(&x, &y, sizeof(double)) == 0;
+}
 
-vector< double > LoanH;
-double GLoan;
+/*
+ * The loan book is a pool of fixed-size loan records.
+ * The loans of an account form a doubly linked list through the pool, in the order they were given.
+ * Slots of repaid loans are recycled through a free list, so a removal is O(1) and the pool only grows with the peak number of live loans.
+ * PayByLoan: the amount of loan taken by the firm from each of its banks. These amounts are used first to pay suppliers
+ * NPL: the non-performing loans for each firm with its banks (bank by bank)
+*/
 
-vector< double > EquityH;
-double GEquity;
 
-vector< double > GvtSupportH;
-double GvtSupport;
+struct LoanRecord
+{
+	double Capital; //The borrowed capital
+	double Rate; //The applied interest rate
+	double Periodic; //The periodic amortization
+	int Paid; //Number of paid periods
+	int Missed; //Count periods of non-payment before declaring loan default
+	int State; //0: healthy loan with payment; 1: paid loan 2: defaulted loan
+	int LongTerm; //0: short-term loan; 1: long-term loan
+	int Prev;
+	int Next;
+};
+
+struct LoanBook
+{
+	vector<LoanRecord> Pool;
+	int FreeHead = -1;
 
-vector< double > RateNPLH;
-double RateNPL;
-double CountNPL;
+	vector<int> Head; //First loan of each account; -1 if none
+	vector<int> Tail; //Last loan of each account; -1 if none
+	vector<char> Opened; //1 once the account has received a loan
+	vector<double> Balance; //Loan; Deposit of each account: two values per account
+	vector<double> PayByLoan;
+	vector<double> NPL;
 
-unordered_map<int, vector< double > > NetworkStatisticsHoH;
+	double* Account(int a) {return &Balance[2*a];}
 
-unordered_map<int, vector< double>> BankNPLH;
+	int Add(int a, double capital, double rate, double periodic, int long_term)
+	{
+		LoanRecord loan;
+		loan.Capital = capital;
+		loan.Rate = rate;
+		loan.Periodic = periodic;
+		loan.Paid = 0;
+		loan.Missed = 0;
+		loan.State = 0;
+		loan.LongTerm = long_term;
+		return Add(a, loan);
+	}
 
-unordered_map<int, vector<int> > BankDegreeH;
+	int Add(int a, const LoanRecord& record)
+	{
+		int l;
+		if (FreeHead != -1)
+		{
+			l = FreeHead;
+			FreeHead = Pool[l].Next;
+		}
+		else
+		{
+			l = Pool.size();
+			Pool.push_back(LoanRecord());
+		}
+		LoanRecord& loan = Pool[l];
+		loan = record;
+		loan.Prev = Tail[a];
+		loan.Next = -1;
+		if (Tail[a] != -1){Pool[Tail[a]].Next = l;}
+		else {Head[a] = l;}
+		Tail[a] = l;
+		Opened[a] = 1;
+		return l;
+	}
 
-unordered_map<int, vector<int> > BankLoanDepositH;
+	/*Unlink only touches the account a: accounts of different firms can be updated in parallel*/
+	void Unlink(int a, int l)
+	{
+		LoanRecord& loan = Pool[l];
+		if (loan.Prev != -1){Pool[loan.Prev].Next = loan.Next;}
+		else {Head[a] = loan.Next;}
+		if (loan.Next != -1){Pool[loan.Next].Prev = loan.Prev;}
+		else {Tail[a] = loan.Prev;}
+	}
 
-unordered_map<int, int > GeographicLocationH;
+	void Release(int l)
+	{
+		Pool[l].Next = FreeHead;
+		FreeHead = l;
+	}
 
-unordered_map<int, int > SectorH;
+	void Remove(int a, int l)
+	{
+		Unlink(a, l);
+		Release(l);
+	}
+};
 
-unordered_map<int, int > CommunityH;
 
 /*
- * Define the profit of the firm:
- * 1- ExpensesH: This unordered map is update each step in the payment function
- * 2- For the revenue, we can use the rzDemandVectorH
+ * The financial phase runs in parallel over fixed blocks of firms.
+ * Each block keeps its own partial sums and logs; they are merged in the order of the blocks, so the result does not depend on the number of threads.
 */
 
-unordered_map<int, double > ExpensesH;
+const int FirmBlock = 1024;
 
-unordered_map<int, vector < double >> SimGDPH;
-unordered_map<int, vector<double> > SimLoansH;
-unordered_map<int, vector<double> > SimNPLH;
-unordered_map<int, vector<double> > SimNPLRateH;
-unordered_map<int, vector<double> > SimDepositH;
+struct NewLoan
+{
+	int Account;
+	LoanRecord Loan;
+	bool Repaid; //1 if the loan was totally paid in the period it was given
+};
 
-/*
- * All functions and procedure of the artificial economy
-*/
+struct FinanceBlock
+{
+	double GLoan;
+	double GNPL;
+	double GDeposit;
+	double GEquity;
+	double GvtSupport;
+	int Missed; //Loan payments missed in the period
+	vector<NewLoan> Requests; //short-term loans given in the period, to add to the loan book
+	vector<int> Repaid; //loan records to give back to the pool
+	vector<pair<int, double> > BankNPL; //bank; NPL ratio of each defaulted loan
+};
 
-/*This function is used to calculate the minimum of unordered map*/
-bool compare(std::pair<int ,double> i, pair<int, double> j) {
-  return i.second < j.second;
-}
 
 const double epsilon = 1e-10;
 inline bool almost_equal(double x, double y)
@@ -274,1101 +617,4056 @@ inline bool almost_equal3(double x, double y)
   return std::fabs(x - y) < epsilon3;
 }
 
-typedef long unsigned int luint;
-luint poisson(luint lambda) {
-    double L = exp(-double(lambda));
-    luint k = 0;
-    double p = 1;
-    do {
-        k++;
-	double rNum=((double)(rand()/(double)RAND_MAX));
-        p *= rNum;
-    } while( p > L);
-    return (k-1);
+/*
+ * Equation (7): the production allowed by the inventory of each sector is Pini*S_s/A_s; the firm is constrained by the smallest one.
+ * The kernel works on the packed sector arrays of one firm, without allocation.
+ * On x86 the AVX-512 or AVX2 version is selected once at run time; the scalar version is the fallback.
+*/
+
+double MinPproiScalar(double pini, const double* inventory, const double* aij, int size)
+{
+	double min = pini*inventory[0]/aij[0];
+	for (int k = 1; k < size; k++)
+	{
+		double pproi = pini*inventory[k]/aij[k];
+		if (pproi < min){min = pproi;}
+	}
+	return min;
 }
 
-double Scale(double min, double max, double x)
+#ifdef SNSE_X86_SIMD
+__attribute__((target("avx2")))
+double MinPproiAVX2(double pini, const double* inventory, const double* aij, int size)
 {
-    double number;
-    number = (GammaMax - GammaMin)*(x - min)/(max - min) + GammaMin;
-    return number;
+	if (size < 4){return MinPproiScalar(pini, inventory, aij, size);}
+	__m256d p = _mm256_set1_pd(pini);
+	__m256d min = _mm256_div_pd(_mm256_mul_pd(p, _mm256_loadu_pd(inventory)), _mm256_loadu_pd(aij));
+	int k = 4;
+	for (; k + 4 <= size; k += 4)
+	{
+		min = _mm256_min_pd(min, _mm256_div_pd(_mm256_mul_pd(p, _mm256_loadu_pd(inventory+k)), _mm256_loadu_pd(aij+k)));
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, min);
+	double result = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+	for (; k < size; k++)
+	{
+		double pproi = pini*inventory[k]/aij[k];
+		if (pproi < result){result = pproi;}
+	}
+	return result;
 }
 
-void Clearing()
-{
-	unordered_map<int, int >().swap(DaysH);
-	unordered_map<int, unordered_map<int, vector<double> > >().swap(OutPutFirmHoH);
-	unordered_map<int, unordered_map<int, vector<double> > >().swap(InPutFirmHoH);
-	unordered_map<int, double >().swap(ProductionIniH);
-	unordered_map<int, double >().swap(CurrentProductionH);
-	unordered_map<int, double >().swap(cVectorH);
-	unordered_map<int, unordered_map<int, double > >().swap(rOrdersHoH);
-	unordered_map<int, double >().swap(dOrdersH);
-	unordered_map<int, double >().swap(GROrdersH);
-	unordered_map<int, double >().swap(rcDemandVectorH);
-	unordered_map<int, unordered_map <int, double > >().swap(rcDemandFirmLevelH);
-	unordered_map<int, double>().swap(rzDemandVectorH);
-	unordered_map<int, unordered_map<int, vector<double> > >().swap(fInventoryHoH);
-	unordered_map<int, unordered_map<int, double> >().swap(AccfInventoryHoH);
-	unordered_map<int, unordered_map<int, double > >().swap(sInventoryHoH);
-	unordered_map<int, unordered_map<int, double > >().swap(AccsInventoryHoH);
-	unordered_map<int, unordered_map<int, double > >().swap(AijSectorHoH);
-	unordered_map<int, double >().swap(fUsedInventoryH);
-	unordered_map<int, vector<double> >().swap(ValueAddedVectorH);
-	set <int>().swap(DamagedFirmsH);
-	set <int>().swap(ListSupplier);
-	set <int>().swap(ListCustomer);
-	set <int>().swap(Firms);
-	set <int>().swap(InactiveFirms);
-	unordered_map<int,int>().swap(ListofFirmsH);
-	unordered_map<int, double >().swap(DeltaH);
-	unordered_map<int, double >().swap(RecoveryH);
-	unordered_map<int, double >().swap(LTLoansH);
-	unordered_map<int, double >().swap(ProfitToSalesH);
-	vector< double >().swap(GDP);
-	unordered_map<int, double >().swap(Total_Output);
-	unordered_map<int, double >().swap(Total_Input);
-	unordered_map<int, vector < double > >().swap(FirmBSH);
-	unordered_map<int, unordered_map<int, vector < double > > >().swap(FirmBankHoH);
-	unordered_map<int, unordered_map<int, unordered_map<int, vector < double > > > >().swap(CurrentLoansHoH);
-	unordered_map<int, unordered_map<int, int > >().swap(LoanKeyHoH);
-	unordered_map<int, int >().swap(LoanFlagH);
-	unordered_map<int, unordered_map<int, double > >().swap(PayByLoanHoH);
-	unordered_map<int, unordered_map<int, double > >().swap(NPLHoH);
-	vector< double >().swap(NPLH);
-	vector< double >().swap(DepositH);
-	vector< double >().swap(LoanH);
-	vector< double >().swap(EquityH);
-	vector< double >().swap(RateNPLH);
-	unordered_map<int, vector< double > >().swap(NetworkStatisticsHoH);
-	unordered_map<int, vector< double>>().swap(BankNPLH);
-	unordered_map<int, vector<int> >().swap(BankDegreeH);
-	unordered_map<int, vector<int> >().swap(BankLoanDepositH);
-	unordered_map<int, int >().swap(GeographicLocationH);
-	unordered_map<int, int >().swap(SectorH);
-	unordered_map<int, int >().swap(CommunityH);
-	unordered_map<int, double >().swap(ExpensesH);
-	unordered_map<int, int >().swap(FirmsNoLoansH);
-}
-
-void Initial_Data()
+__attribute__((target("avx512f")))
+double MinPproiAVX512(double pini, const double* inventory, const double* aij, int size)
 {
-	n = 15;
-	tau = 6;
-	t = 0;
-	disaster = 0;
-	HelpFirms = 1;
-	GammaMin = 0.001;
-	GammaMax = 0.004;
-	NumberDamagedFirms = 0.03;
-	DamageMagnitude = 0.512040958832949;
-	LimitSolvencyRatio = 0.034;
-	StartRecover = 5; //Number of days before starting recovery
-	LoanMaturity = 53; //The maturity of all loans in number of days
-	LTLoanMaturity = 399;
-	WithPayment = 1; //Model with payment from customers to suppliers or not
-	ShortLoans = 1; //Model with short term loans given by banks to firms or not
-	LTLoansModel = 1; //Model with short term loans given by banks to firms or not
-	ShortInterestRate = 1; //Model with 0 short term interest rate or not
-	LimitToDefault = 10; //Number of day without payment before declaring loan default
-	BankRiskManager = 1; //If 1 the bank is a risk manager; 0: the bank has no risk policy in case of disaster; Give priority of the economic recovery
-	location_of_disaster = 35; //35: Tokyo, 52: Kyoto, 53: Osaka, 54: Hyogo; 48: Aichi
-	sector_of_disaster = 3111;
-	community_of_disaster = 2;
-	DisasterScenario = 0; //0: Random Selection from the whole network; 1: Random selection from one prefecture ; 2: Random selection from one sector; 3: Random selection from one community
+	if (size < 8){return MinPproiAVX2(pini, inventory, aij, size);}
+	__m512d p = _mm512_set1_pd(pini);
+	__m512d min = _mm512_div_pd(_mm512_mul_pd(p, _mm512_loadu_pd(inventory)), _mm512_loadu_pd(aij));
+	int k = 8;
+	for (; k + 8 <= size; k += 8)
+	{
+		min = _mm512_min_pd(min, _mm512_div_pd(_mm512_mul_pd(p, _mm512_loadu_pd(inventory+k)), _mm512_loadu_pd(aij+k)));
+	}
+	if (k < size)
+	{
+		/*The tail reuses the first lanes of the current minimum for the masked-out positions*/
+		__mmask8 mask = (__mmask8)((1u << (size - k)) - 1);
+		__m512d tail = _mm512_div_pd(_mm512_mul_pd(p, _mm512_maskz_loadu_pd(mask, inventory+k)), _mm512_mask_loadu_pd(_mm512_set1_pd(1.0), mask, aij+k));
+		min = _mm512_mask_min_pd(min, mask, min, tail);
+	}
+	return _mm512_reduce_min_pd(min);
+}
+#endif
 
-	GNPL = 0;
-	GDeposit = 0;
-	GLoan = 0;
-	GEquity = 0;
-    RateNPL = 0;
-	CountNPL = 0;
-	GvtSupport = 0;
-	/*
-	 * Upload network data
-	 * Initialize all economic variables: price, demand, inventory...
-	*/
-	ifstream OutPut1,OutPut2,CVector, ListFirms, Production, FirmBS, FirmBank,NetStat,Location, Sector,Profit,ProfitTax;
-    /*
-     * File structure: supplier - customer - weight (Aij) - sector of supplier - location of supplier- sector of customer - location of customer - final goods (consumption Ci of supplier) - final goods (consumption Ci of customer)
-     * This part upload data from the file InOutput.dat (OutPutFirmHoH and InPutFirmHoH)
-     * Initialization of the price: All firms have the same initial price: P0 = 1
-     * Upload consumption goods data: cVectorH
-     * Initialize the Inventory at firm level: suppose that the inventory at t = 0 is the amount of initial trade Aij.
-    */
+typedef double (*MinPproiKernel)(double, const double*, const double*, int);
 
+MinPproiKernel SelectMinPproi()
+{
+#ifdef SNSE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")){return MinPproiAVX512;}
+	if (__builtin_cpu_supports("avx2")){return MinPproiAVX2;}
+#endif
+	return MinPproiScalar;
+}
 
-	OutPut1.open("Data/ToyTable1.txt");
-	OutPut2.open("Data/ToyTable1.txt");
-	CVector.open("Data/CToy1.txt");
-	ListFirms.open("Data/ToyKJ.txt");
-	Production.open("Data/ToyPini.txt");
-	FirmBS.open("Data/BSToy.txt");
-	FirmBank.open("Data/FBToy.txt");
-	NetStat.open("Data/FirmClusters.txt");
-    Location.open("Data/toyGeography.txt");
-	Sector.open("Data/toySector.txt");
-	Profit.open("Data/toyProfitToSales.txt");
+MinPproiKernel MinPproi = SelectMinPproi();
 
-	std::string opline, cline, kjline, prodline, bsline, fbline, statline, locline, secline, profitline,taxline;
+/*
+ * Counter-based random numbers (SplitMix64 mixing).
+ * The n-th number of a stream is a hash of the key of the stream and n: it doesn't depend on the other draws, so draws can be made in any order or in parallel.
+ * The key of a stream mixes the master seed, the replication and the purpose of the draws, so each replication can be simulated again on its own.
+*/
 
-	while(getline(NetStat,statline))
-	{
-		std::string ID;
-		std::string clusters;
-		std::string knn;
+enum RandomPurpose {DaysDraws = 1, DamageDraws = 2, SyntheticDraws = 3, SyntheticLinkDraws = 4};
 
-		istringstream stat(statline);
-		stat >> ID;
-		stat >> clusters;
-		stat >> knn;
+inline uint64_t SplitMix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
 
-		NetworkStatisticsHoH[std::stoi(ID)].push_back(std::stod(clusters));
-		NetworkStatisticsHoH[std::stoi(ID)].push_back(std::stod(knn));
-	}
-	NetStat.close();
+struct RandomStream
+{
+	uint64_t Key;
+	uint64_t Counter; //Position of the next number of Next()
 
-	while(getline(Profit,profitline))
-	{
-		std::string ID;
-		std::string ratio;
+	RandomStream(uint64_t seed, uint64_t replication, uint64_t purpose)
+		: Key(SplitMix64(SplitMix64(SplitMix64(seed) ^ replication) ^ purpose)), Counter(0) {}
 
-		istringstream stat(profitline);
-		stat >> ID;
-		stat >> ratio;
+	uint64_t Bits(uint64_t n) const {return SplitMix64(Key ^ SplitMix64(n));}
+	double Uniform(uint64_t n) const {return (Bits(n) >> 11)*(1.0/9007199254740992.0);} //[0,1) with 53 bits
+	uint64_t Next() {return Bits(Counter++);}
+	double NextUniform() {return Uniform(Counter++);}
+};
 
-		ProfitToSalesH[std::stoi(ID)] = std::stod(ratio);
-	}
-	Profit.close();
+/*
+ * Draws of a Poisson law with mean lambda, redrawn while the draw is 0.
+ * The cumulative distribution of the positive values is tabulated once, so each draw is one uniform number and a branch-free count over the table:
+ * the draws of all links are independent and made in one vectorized loop.
+*/
 
-	while(getline(Location,locline))
-	{
-		std::string ID;
-		std::string Pref;
+struct PoissonTable
+{
+	vector<double> CDF; //CDF[j] = P(X <= j+1 | X > 0)
 
-		istringstream stat(locline);
-		stat >> ID;
-		stat >> Pref;
-		GeographicLocationH[std::stoi(ID)]=std::stoi(Pref);
+	void Build(double lambda)
+	{
+		CDF.clear();
+		double zero = exp(-lambda);
+		double p = zero;
+		double cumulative = 0;
+		for (int k = 1; ; k++)
+		{
+			p *= lambda/k;
+			cumulative += p/(1 - zero);
+			if ((k > lambda) and (p/(1 - zero) < 1e-17)){break;}
+			CDF.push_back(cumulative);
+		}
 	}
-	Location.close();
 
-	while(getline(Sector,secline))
+	int Draw(double u) const
 	{
-		std::string ID;
-		std::string Index;
-		std::string Sector;
-		std::string New_Index;
-		std::string New_Sector;
-
-
-		istringstream stat(secline);
-		stat >> ID;
-		stat >> Index;
-		stat >> Sector;
-		stat >> New_Index;
-		stat >> New_Sector;
-		SectorH[std::stoi(ID)]=std::stoi(New_Index);
+		int k = 1;
+		const double* cdf = CDF.data();
+		int size = CDF.size();
+		for (int j = 0; j < size; j++){k += (u >= cdf[j]);}
+		return k;
 	}
-	Sector.close();
+};
 
-	while(getline(FirmBank,fbline))
-	{
-		std::string FID;
-		std::string BID;
-		std::string loan;
-		std::string deposit;
+/*
+ * Profiling
+ * Each phase of a step has a timer and a number of calls, and the steps count a few events of the model.
+ * The wall phases are timed once per step, on the thread of the replication: a parallel loop is timed as a whole, from its start to the end of its last firm.
+ * The thread phases are the functions of a firm inside the parallel loops. Their timers cost two clock reads per firm and call, as much as the functions themselves,
+ * so they are only compiled with -DSNSE_PROFILE_CALLS=1: their time is then summed over the threads, and a function called inside another one is also counted in it.
+ * The counters are kept per thread and summed at the end of the replication; the run writes their sum in ProfileReport.
+ * Compiled with -DSNSE_PROFILE=0, the timers and the counters are removed from the steps.
+*/
 
-		istringstream fb(fbline);
-		fb >> FID;
-		fb >> BID;
-		fb >> loan;
-		fb >> deposit;
+#ifndef SNSE_PROFILE
+#define SNSE_PROFILE 1
+#endif
+#ifndef SNSE_PROFILE_CALLS
+#define SNSE_PROFILE_CALLS 0
+#endif
 
-		FirmBankHoH[std::stoi(FID)][std::stoi(BID)].push_back(std::stod(loan));
-		FirmBankHoH[std::stoi(FID)][std::stoi(BID)].push_back(std::stod(deposit));
-		LoanKeyHoH[std::stoi(FID)][std::stoi(BID)] = 0;
-		BankNPLH[std::stoi(BID)] = {0,0};
-		BankLoanDepositH[std::stoi(BID)] = {0,0};
-		BankDegreeH[std::stoi(BID)].push_back(std::stoi(FID));
-	}
-	FirmBank.close();
+enum ProfilePhase {PhaseStep, PhaseDesiredGoods, PhaseProductionLoop, PhaseProduction, PhaseTrading, PhaseRationing, PhaseReplayTrading, PhaseReceiveGoods,
+	PhaseFinanceLoop, PhaseNeedLoan, PhasePayment, PhaseBalanceSheet, PhaseOpenLoans, PhaseReturnGoods, PhaseLoanCleanup, PhaseInventory, PhaseCount};
 
-	while(getline(FirmBS,bsline))
-	{
-		std::string ID;
-		std::string deposit;
-		std::string OA;
-		std::string loan;
-		std::string equity;
-		std::string OL;
+struct ProfilePhaseName
+{
+	const char* Name;
+	bool Wall;
+};
 
-		istringstream bs(bsline);
-		bs >> ID;
-		bs >> deposit;
-		bs >> OA;
-		bs >> loan;
-		bs >> equity;
-		bs >> OL;
+const ProfilePhaseName ProfilePhases[PhaseCount] = {
+	{"Step", 1}, {"Desired_Goods", 1}, {"ProductionTrading", 1}, {"ProductionInoue18", 0}, {"Trading", 0}, {"Rationing", 0}, {"Replay_Trading", 0}, {"Receive_Goods", 1},
+	{"Finance", 1}, {"NeedLoan", 0}, {"Payment", 0}, {"FirmBS_Update", 0}, {"Open_Loans", 1}, {"Return_Goods", 1}, {"LoanCleanup", 1}, {"InventoryUpdate", 1}};
 
-		FirmBSH[std::stoi(ID)].push_back(std::stod(deposit));
-		FirmBSH[std::stoi(ID)].push_back(std::stod(OA));
-		FirmBSH[std::stoi(ID)].push_back(std::stod(loan));
-		FirmBSH[std::stoi(ID)].push_back(std::stod(equity));
-		FirmBSH[std::stoi(ID)].push_back(std::stod(OL));
+enum ProfileEvent {EventRationedFirms, EventLoansIssued, EventLoanDefaults, EventGvtSupport, EventCount};
 
-		FirmsNoLoansH[std::stoi(ID)] = 0; //Loan rejection data
+const char* const ProfileEvents[EventCount] = {"RationedFirms", "LoansIssued", "LoanDefaults", "GvtSupport"};
 
-	}
+/*The counters of one thread fill their own cache lines*/
+struct alignas(64) ProfileCounters
+{
+	double Seconds[PhaseCount] = {};
+	int64_t Calls[PhaseCount] = {};
+	int64_t Events[EventCount] = {};
 
-	FirmBS.close();
-	while(getline(OutPut1,opline))
+	void Add(const ProfileCounters& other)
 	{
-		std::string supplier;
-		std::string customer;
-		std::string weight;
+		for (int p = 0; p < PhaseCount; p++)
+		{
+			Seconds[p] += other.Seconds[p];
+			Calls[p] += other.Calls[p];
+		}
+		for (int e = 0; e < EventCount; e++){Events[e] += other.Events[e];}
+	}
+};
 
-		istringstream op(opline);
-		op >> supplier;
-		op >> customer;
-		op >> weight;
+/*A wall phase of one step, for the trace; the times are in microseconds since the start of the run*/
+struct TraceSpan
+{
+	int Phase;
+	int Step;
+	double Start;
+	double Duration;
+};
 
-		ListSupplier.insert(std::stoi(supplier));
-		ListCustomer.insert(std::stoi(customer));
-	}
+const std::chrono::steady_clock::time_point ProfileEpoch = std::chrono::steady_clock::now();
 
-	OutPut1.close();
+inline int ProfileThread()
+{
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
 
-	while (getline(CVector,cline))
-	{
-		std::string ID;
-		std::string Ci;
+inline int ProfileThreads()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
 
-		istringstream cl(cline);
-		cl >> ID;
-		cl >> Ci;
-		if (((ListSupplier.find(std::stoi(ID)) != ListSupplier.end())==1) or ((ListCustomer.find(std::stoi(ID)) != ListCustomer.end())==1))
-		{cVectorH[std::stoi(ID)] = std::stod(Ci);}
-	}
+/*
+ * The series saved by one replication, kept by the driver once the replication is finished
+*/
 
-	CVector.close();
+struct SimulationResults
+{
+	vector< double > GDP;
+	vector< double > NPLH;
+	vector< double > DepositH;
+	vector< double > LoanH;
+	vector< double > EquityH;
+	vector< double > RateNPLH;
+	vector<int> DamagedFirms; //IDs of the damaged firms
+	double GvtSupport;
+	ProfileCounters Timing; //Sum of the profiling counters of the threads
+	vector<TraceSpan> Trace;
+};
 
-	while (getline(Production,prodline))
-	{
-		std::string ID;
-		std::string Pini;
+/*
+ * One replication of the artificial economy.
+ * It reads the shared network and owns all the variables which evolve during the simulation, so several replications can run at the same time.
+*/
 
-		istringstream prod(prodline);
-		prod >> ID;
-		prod >> Pini;
-		if (((cVectorH.find(std::stoi(ID)) != cVectorH.end())==1))
-		{
-			ProductionIniH[std::stoi(ID)]= std::stod(Pini);
-			rzDemandVectorH[std::stoi(ID)]= std::stod(Pini);
-		}
-	}
+class Simulation
+{
+public:
+	Simulation(const Network& network, int replication, uint64_t seed);
+	Simulation(const Simulation& snapshot, int replication);
 
-	Production.close();
+	/*
+	 * Model parameters
+	 * The number of day of utilization of products by firms i (n_i).
+	 * The number of days to adjust the inventory size (tau)
+	*/
+	int n;
+	int tau;
+	int t;
+	int disaster;
+	int StationaryDays; //Number of consecutive steps which satisfy the conditions of the equilibrium since the start of the window
+	Column<double> Residual; //(Pact - Pini)/Pini of each firm at the start of the window
+	int HelpFirms;
+	double GammaMin;
+	double GammaMax;
+	double NumberDamagedFirms;
+	double DamageMagnitude;
+	double LimitSolvencyRatio;
+	int StartRecover; //Number of days before starting recovery
+	int LoanMaturity; //The maturity of all loans in number of days
+	int LTLoanMaturity;
+	int WithPayment; //Model with payment from customers to suppliers or not
+	int ShortLoans; //Model with short term loans given by banks to firms or not
+	int LTLoansModel; //Model with short term loans given by banks to firms or not
+	int ShortInterestRate; //Model with 0 short term interest rate or not
+	int LimitToDefault; //Number of day without payment before declaring loan default
+	int BankRiskManager; //If 1 the bank is a risk manager; 0: the bank has no risk policy in case of disaster; Give priority of the economic recovery
+	int location_of_disaster; //35: Tokyo, 52: Kyoto, 53: Osaka, 54: Hyogo
+	int sector_of_disaster ;
+	int community_of_disaster;
+	int DisasterScenario; //0: Random Selection from the whole network; 1: Random selection from one prefecture ; 2: Random selection from one sector; 3: Random selection from one community
+
+	int Replication;
+	uint64_t Seed; //Master seed
+	RandomStream DamageRandom; //Selection of the damaged firms
 
-	while (getline(ListFirms,kjline))
-	{
-		std::string ID, sector;
+	/*
+	 * The shared network
+	*/
+	const Network& Net;
+	const vector<int>& FirmIDs; //Dense index -> firm ID
+	const CSRLinks& OutLinks; //Aji
+	const CSRLinks& InLinks; //Aij
+	const FirmProfile& Profile;
+	const SectorLayout& Sectors;
+	const AccountLayout& Accounts;
 
-		istringstream kj(kjline);
-		kj >> ID;
-		kj >> sector;
-		if (((cVectorH.find(std::stoi(ID)) != cVectorH.end())==1))
-		{ListofFirmsH[std::stoi(ID)] = std::stoi(sector);}
-	}
+	FirmState Firm;
 
-	ListFirms.close();
+	/*
+	 * At each step t, each firm i realizes a list of orders from its suppliers j denoted by O_{ij,t}^{*} as in Inoue and Todo (2018)
+	 * Another data structure for the received demand firm by firm: for each supplier, we note all orders client by client.
+	*/
+	vector<double> dOrdersV; //O_{ij,t}, indexed by in link
+	vector<double> rOrdersV; //O_{ij,t}^{*}, indexed by in link
+	vector<double> rReturnedV; //Goods returned to the supplier by a customer who cannot pay, indexed by in link
+	vector<double> rcDemandFirmLevelV; //D_{ij,t}, indexed by out link
 
-	while(getline(OutPut2,opline))
-	{
-		std::string supplier;
-		std::string customer;
-		std::string weight;
+	/*
+	 * Each firm i holds inventory from different of its suppliers j.
+	 * The firm level inventory evolution is saved by in link.
+	 * Inventory is measured by sector for the production.
+	*/
+	vector<double> fInventoryV; //Sij, indexed by in link
+	vector<double> AccfInventoryV; //employed during trading only to calculate the added new inventory, indexed by in link
+	SectorInventory Stock;
+	ActiveSet Frontier;
+	FirmPanel ValueAdded;
+
+	/*
+	 * List of damaged firms randomly selected (dense firm indices)
+	*/
+	set <int> DamagedFirmsH; //List of damaged firms
 
-		istringstream op(opline);
-		op >> supplier;
-		op >> customer;
-		op >> weight;
+	vector< double > GDP;
+	double ValueGDP;
 
-		OutPutFirmHoH[std::stoi(supplier)][std::stoi(customer)].push_back(std::stod(weight));
-	    OutPutFirmHoH[std::stoi(supplier)][std::stoi(customer)].push_back(ListofFirmsH[std::stoi(customer)]);
-	    OutPutFirmHoH[std::stoi(supplier)][std::stoi(customer)].push_back(1/std::stod(weight));
+	/*
+	 * Firm - Bank network
+	*/
+	LoanBook Loans;
+	vector<FinanceBlock> Finance;
 
-	    InPutFirmHoH[std::stoi(customer)][std::stoi(supplier)].push_back(std::stod(weight));
-	    InPutFirmHoH[std::stoi(customer)][std::stoi(supplier)].push_back(ListofFirmsH[std::stoi(supplier)]);
-	    InPutFirmHoH[std::stoi(customer)][std::stoi(supplier)].push_back(1/std::stod(weight));
+	/*
+	 * Save financial statistics
+	*/
+	vector< double > NPLH;
+	double GNPL;
 
-	    int n_cust = 0, n_supp = 0;
+	vector< double > DepositH;
+	double GDeposit;
 
-	    while(n_cust == 0){n_cust=poisson(n);}
-	    while(n_supp == 0){n_supp=poisson(n);}
+	vector< double > LoanH;
+	double GLoan;
 
-	    DaysH[std::stoi(customer)] = n_cust;
-	    DaysH[std::stoi(supplier)] = n_supp;
+	vector< double > EquityH;
+	double GEquity;
 
-	    Firms.insert(std::stoi(supplier));
-	    Firms.insert(std::stoi(customer));
+	double GvtSupport;
 
-	    DeltaH[std::stoi(supplier)] = 0;
-	    DeltaH[std::stoi(customer)] = 0;
+	vector< double > RateNPLH;
+	double RateNPL;
+	double CountNPL;
 
-	    if (((ProductionIniH.find(std::stoi(supplier)) != ProductionIniH.end())==0))
-	    {
-		    InactiveFirms.insert(std::stoi(supplier));
-	    }
-	    if (((ProductionIniH.find(std::stoi(customer)) != ProductionIniH.end())==0))
-	    {
-		    InactiveFirms.insert(std::stoi(customer));
-	    }
-	}
-	OutPut2.close();
+	unordered_map<int, vector< double>> BankNPLH;
+	unordered_map<int, vector<int> > BankLoanDepositH;
 
-	for(unordered_map<int, unordered_map<int, vector<double> > >::iterator itS=OutPutFirmHoH.begin(); itS!=OutPutFirmHoH.end();itS++)
-	{
-		double output = 0;
-		for(unordered_map<int, vector<double> >::iterator itC=OutPutFirmHoH[(*itS).first].begin(); itC!=OutPutFirmHoH[(*itS).first].end();itC++)
-		{
-			output += OutPutFirmHoH[(*itS).first][(*itC).first][0];
-		}
-		Total_Output[(*itS).first] = output+cVectorH[(*itS).first];
-	}
+	/*
+	 * Profiling: the counters of the threads and the wall phases of the steps for the trace
+	*/
+	vector<ProfileCounters> Timing;
+	vector<TraceSpan> Trace;
+	ProfileCounters& Counters() {return Timing[ProfileThread()];}
+
+	void Initial_Data();
+	void Set_Parameter(int index, double value);
+	void Draw_Inventory();
+	double Scale(double min, double max, double x);
+	void Desired_Goods();
+	double Damage(int i);
+	void DamagedFirms();
+	void ProductionInoue18(int i);
+	void Deliver(int e, double quantity);
+	void Rationing(int i);
+	void RationingCustomers(int i);
+	void Trading(int i);
+	void Replay_Trading(int i);
+	void Receive_Goods();
+	void CannotPay(int i);
+	void LoanDemandSupply(int i, FinanceBlock& block);
+	void Open_Loans();
+	void NeedLoan(int i, FinanceBlock& block);
+	void Payment(int i);
+	bool Service_Loan(LoanRecord& loan, int a, double* account, double& paid_capital, double& total_amortization, FinanceBlock& block);
+	void FirmBS_Update(int i, FinanceBlock& block);
+	void Return_Goods();
+	void OneStepSimulation();
+	void Simulate();
+	void Step();
+	bool Stationary_Step();
+	void Fill_Equilibrium();
+	void Record_ValueAdded(int day);
+	void Open_Panel();
+	void Write_Panel();
+	void Bank_Balances();
+	SimulationResults Results();
+
+	template <typename Archive> void State(Archive& archive);
+	void Write_Checkpoint();
+	bool Read_Checkpoint();
+	void Memory(MemoryReport& report) const;
+};
+
+/*Times a phase from its start to the end of the scope*/
+struct PhaseTimer
+{
+	Simulation& Sim;
+	ProfilePhase Phase;
+	int Step;
+	std::chrono::steady_clock::time_point Start;
 
-	for(unordered_map<int, unordered_map<int, vector<double> > >::iterator itC=InPutFirmHoH.begin(); itC!=InPutFirmHoH.end();itC++)
+	PhaseTimer(Simulation& sim, ProfilePhase phase) : Sim(sim), Phase(phase), Step(sim.t), Start(std::chrono::steady_clock::now()) {}
+
+	~PhaseTimer()
 	{
-		double input = 0;
-		for(unordered_map<int, vector<double> >::iterator itS=InPutFirmHoH[(*itC).first].begin(); itS!=InPutFirmHoH[(*itC).first].end();itS++)
+		std::chrono::steady_clock::time_point finish = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(finish - Start).count();
+		ProfileCounters& counters = Sim.Counters();
+		counters.Seconds[Phase] += seconds;
+		counters.Calls[Phase]++;
+		if (ProfilePhases[Phase].Wall and (ProfileTrace.empty() == 0))
 		{
-			input += InPutFirmHoH[(*itC).first][(*itS).first][0];
-			fInventoryHoH[(*itC).first][(*itS).first].push_back((double)DaysH[(*itC).first]*InPutFirmHoH[(*itC).first][(*itS).first][0]);
-			fInventoryHoH[(*itC).first][(*itS).first].push_back(ListofFirmsH[(*itS).first]);
-
-			sInventoryHoH[(*itC).first][ListofFirmsH[(*itS).first]] += (double)DaysH[(*itC).first]*InPutFirmHoH[(*itC).first][(*itS).first][0];
-			AijSectorHoH[(*itC).first][ListofFirmsH[(*itS).first]] += InPutFirmHoH[(*itC).first][(*itS).first][0];
+			TraceSpan span = {Phase, Step, std::chrono::duration<double, std::micro>(Start - ProfileEpoch).count(), seconds*1e6};
+			Sim.Trace.push_back(span);
 		}
-
-		Total_Input[(*itC).first] = input;
-		FirmBSH[(*itC).first][0]=input;
-		FirmBSH[(*itC).first][3]=FirmBSH[(*itC).first][0]+FirmBSH[(*itC).first][1]-FirmBSH[(*itC).first][2]-FirmBSH[(*itC).first][4];
 	}
+};
+
+#if SNSE_PROFILE
+#define PROFILE_SCOPE(phase) PhaseTimer phase_timer(*this, phase)
+#define PROFILE_EVENT(event) (Counters().Events[event]++)
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_EVENT(event)
+#endif
+
+/*The timer of a function of a firm, only with -DSNSE_PROFILE_CALLS=1*/
+#if SNSE_PROFILE and SNSE_PROFILE_CALLS
+#define PROFILE_CALL(phase) PhaseTimer phase_timer(*this, phase)
+#else
+#define PROFILE_CALL(phase)
+#endif
+
+/*The phases which are timed in this build*/
+inline bool ProfiledPhase(int phase) {return ProfilePhases[phase].Wall or SNSE_PROFILE_CALLS;}
 
-}
+/*
+ * The parameters which can be set by name, e.g. by a parameter sweep
+*/
 
-void Desired_Goods()
+struct SimulationParameter
 {
-	/*
-	 * 1- Each firm defines its desired orders to each of its suppliers.
-	 * 2- Each supplier collects all orders and defines its received demand in rcDemandHoH
-	*/
-	/*First loop is to initialize at each step the received demand vector of all firms: Initial values is equal to the final consumption*/
-	for(unordered_map<int, double >::iterator itr=cVectorH.begin(); itr!=cVectorH.end();itr++)
+	const char* Name;
+	int Simulation::*Integer; //Set for the integer parameters
+	double Simulation::*Real; //Set for the real parameters
+};
+
+const SimulationParameter ModelParameters[] = {
+	{"n", &Simulation::n, nullptr},
+	{"tau", &Simulation::tau, nullptr},
+	{"HelpFirms", &Simulation::HelpFirms, nullptr},
+	{"GammaMin", nullptr, &Simulation::GammaMin},
+	{"GammaMax", nullptr, &Simulation::GammaMax},
+	{"NumberDamagedFirms", nullptr, &Simulation::NumberDamagedFirms},
+	{"DamageMagnitude", nullptr, &Simulation::DamageMagnitude},
+	{"LimitSolvencyRatio", nullptr, &Simulation::LimitSolvencyRatio},
+	{"StartRecover", &Simulation::StartRecover, nullptr},
+	{"LoanMaturity", &Simulation::LoanMaturity, nullptr},
+	{"LTLoanMaturity", &Simulation::LTLoanMaturity, nullptr},
+	{"WithPayment", &Simulation::WithPayment, nullptr},
+	{"ShortLoans", &Simulation::ShortLoans, nullptr},
+	{"LTLoansModel", &Simulation::LTLoansModel, nullptr},
+	{"ShortInterestRate", &Simulation::ShortInterestRate, nullptr},
+	{"LimitToDefault", &Simulation::LimitToDefault, nullptr},
+	{"BankRiskManager", &Simulation::BankRiskManager, nullptr},
+	{"location_of_disaster", &Simulation::location_of_disaster, nullptr},
+	{"sector_of_disaster", &Simulation::sector_of_disaster, nullptr},
+	{"community_of_disaster", &Simulation::community_of_disaster, nullptr},
+	{"DisasterScenario", &Simulation::DisasterScenario, nullptr},
+};
+const int ModelParameterCount = sizeof(ModelParameters)/sizeof(ModelParameters[0]);
+
+/*This function returns the index of a parameter in ModelParameters, or -1 if there is no parameter of this name*/
+int ParameterIndex(const std::string& name)
+{
+	for (int p = 0; p < ModelParameterCount; p++)
 	{
-		rcDemandVectorH[(*itr).first] = cVectorH[(*itr).first];
-		dOrdersH[(*itr).first] = 0;
-		GROrdersH[(*itr).first] = 0;
-		ExpensesH[(*itr).first] = 0;
+		if (name == ModelParameters[p].Name){return p;}
 	}
+	return -1;
+}
 
-    double order_ij, quantity;
-    for (unordered_map<int, unordered_map<int, vector<double> > >::iterator itC=InPutFirmHoH.begin(); itC!=InPutFirmHoH.end();itC++)
-    {
-        for (unordered_map<int, vector<double> >::iterator itS=InPutFirmHoH[(*itC).first].begin(); itS!=InPutFirmHoH[(*itC).first].end();itS++)
-        {
-            if ((InactiveFirms.find((*itC).first) != InactiveFirms.end())==0)
-            {
-                quantity = InPutFirmHoH[(*itC).first][(*itS).first][0]*rzDemandVectorH[(*itC).first]/ProductionIniH[(*itC).first];
-                if(almost_equal((double)DaysH[(*itC).first]*quantity , fInventoryHoH[(*itC).first][(*itS).first][0]))
-                {
-                    order_ij = quantity;
-                }
-                else if ((double)DaysH[(*itC).first]*quantity < fInventoryHoH[(*itC).first][(*itS).first][0])
-                {
+/*
+ * All functions and procedure of the artificial economy
+*/
+
+/*
+ * Input files are mapped in memory and parsed in place with std::from_chars, without a copy of the lines.
+ * A large file is split in chunks at line ends which are parsed in parallel; the rows of the chunks are joined in the order of the file.
+ * A malformed line stops the load with the file and the line number.
+ * A missing file is read as an empty file.
+*/
+
+class MappedFile
+{
+public:
+	const char* Begin;
+	const char* End;
+
+	explicit MappedFile(const std::string& path) : Begin(0), End(0), Address(0), Size(0)
+	{
+#ifdef _WIN32
+		File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		Mapping = 0;
+		if (File == INVALID_HANDLE_VALUE){return;}
+		LARGE_INTEGER size;
+		if ((GetFileSizeEx(File, &size) == 0) or (size.QuadPart == 0)){return;}
+		Mapping = CreateFileMappingA(File, 0, PAGE_READONLY, 0, 0, 0);
+		if (Mapping == 0){throw runtime_error(path + ": cannot map the file");}
+		Address = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+		if (Address == 0){throw runtime_error(path + ": cannot map the file");}
+		Size = size.QuadPart;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file == -1){return;}
+		struct stat status;
+		if ((fstat(file, &status) == 0) and (status.st_size > 0))
+		{
+			Address = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (Address == MAP_FAILED){close(file); throw runtime_error(path + ": cannot map the file");}
+			Size = status.st_size;
+			madvise(Address, Size, MADV_SEQUENTIAL);
+		}
+		close(file);
+#endif
+		Begin = static_cast<const char*>(Address);
+		End = Begin + Size;
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (Address != 0){UnmapViewOfFile(Address);}
+		if (Mapping != 0){CloseHandle(Mapping);}
+		if (File != INVALID_HANDLE_VALUE){CloseHandle(File);}
+#else
+		if (Address != 0){munmap(Address, Size);}
+#endif
+	}
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	void* Address;
+	size_t Size;
+#ifdef _WIN32
+	HANDLE File;
+	HANDLE Mapping;
+#endif
+};
+
+/*
+ * The rows read in a file: the values of the columns of each row follow each other; integers are kept exactly.
+*/
+
+struct Table
+{
+	int Columns;
+	vector<double> Values;
+
+	int Rows() const {return (Columns == 0) ? 0 : Values.size()/Columns;}
+	int Int(int r, int c) const {return (int)Values[(size_t)r*Columns + c];}
+	double Double(int r, int c) const {return Values[(size_t)r*Columns + c];}
+};
+
+struct ParseError
+{
+	const char* Position;
+	std::string Message;
+};
+
+inline bool IsBlank(char c) {return (c == ' ') or (c == '\t') or (c == '\r');}
+
+/*
+ * This function parses the lines of [begin, end) with the format of the file: i: integer column; d: real column; -: skipped column.
+ * Columns after the format are ignored and blank lines are skipped.
+*/
+void ParseLines(const char* begin, const char* end, const char* format, vector<double>& values)
+{
+	const char* line = begin;
+	while (line < end)
+	{
+		const char* line_end = static_cast<const char*>(memchr(line, '\n', end - line));
+		if (line_end == 0){line_end = end;}
+		const char* p = line;
+		while ((p < line_end) and IsBlank(*p)){p++;}
+		if (p < line_end)
+		{
+			for (const char* f = format; *f != 0; f++)
+			{
+				while ((p < line_end) and IsBlank(*p)){p++;}
+				if (p == line_end){throw ParseError{p, std::string("missing column ") + to_string(f - format + 1)};}
+				const char* token = p;
+				if (*f == '-')
+				{
+					while ((p < line_end) and !IsBlank(*p)){p++;}
+					continue;
+				}
+				if (*p == '+'){p++;}
+				std::from_chars_result result;
+				if (*f == 'i')
+				{
+					int value = 0;
+					result = std::from_chars(p, line_end, value);
+					values.push_back(value);
+				}
+				else
+				{
+					double value = 0;
+					result = std::from_chars(p, line_end, value);
+					values.push_back(value);
+				}
+				if ((result.ec != std::errc()) or ((result.ptr < line_end) and !IsBlank(*result.ptr)))
+				{
+					const char* token_end = token;
+					while ((token_end < line_end) and !IsBlank(*token_end)){token_end++;}
+					throw ParseError{token, "column " + to_string(f - format + 1) + ": cannot read '" + std::string(token, token_end) + "' as " + ((*f == 'i') ? "an integer" : "a number")};
+				}
+				p = result.ptr;
+			}
+		}
+		line = line_end + 1;
+	}
+}
+
+Table ReadTable(const std::string& path, const char* format)
+{
+	MappedFile file(path);
+	Table table;
+	table.Columns = 0;
+	for (const char* f = format; *f != 0; f++){table.Columns += (*f != '-');}
+
+	/*Chunks of about 4 MB, cut after a line end*/
+	const size_t chunk_size = 1 << 22;
+	vector<const char*> cuts(1, file.Begin);
+	while (file.End - cuts.back() > (ptrdiff_t)chunk_size)
+	{
+		const char* cut = static_cast<const char*>(memchr(cuts.back() + chunk_size, '\n', file.End - cuts.back() - chunk_size));
+		if (cut == 0){break;}
+		cuts.push_back(cut + 1);
+	}
+	cuts.push_back(file.End);
+
+	int chunks = cuts.size() - 1;
+	vector<vector<double> > values(chunks);
+	vector<ParseError> errors(chunks, ParseError{0, ""});
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < chunks; k++)
+	{
+		try {ParseLines(cuts[k], cuts[k+1], format, values[k]);}
+		catch (const ParseError& error) {errors[k] = error;}
+	}
+
+	for (int k = 0; k < chunks; k++)
+	{
+		if (errors[k].Position != 0)
+		{
+			long line = 1 + std::count(file.Begin, errors[k].Position, '\n');
+			throw runtime_error(path + ":" + to_string(line) + ": " + errors[k].Message);
+		}
+	}
+
+	size_t size = 0;
+	for (int k = 0; k < chunks; k++){size += values[k].size();}
+	table.Values.reserve(size);
+	for (int k = 0; k < chunks; k++)
+	{
+		table.Values.insert(table.Values.end(), values[k].begin(), values[k].end());
+		vector<double>().swap(values[k]);
+	}
+	return table;
+}
+
+/*
+ * Compiled network cache
+ * The network built from the input files is saved in one binary file: a header, then the arrays of the network one after the other.
+ * Each array is its number of values followed by the values, padded to 8 bytes; the arrays are copied back without parsing or hashing.
+ * The header holds the version of the format, the size and modification time of each input file and a checksum of the arrays:
+ * the cache is used only if all of them match, otherwise the input files are parsed again and the cache is written anew.
+*/
+
+const char CacheMagic[8] = {'S', 'N', 'S', 'E', 'N', 'E', 'T', '\0'};
+const uint32_t CacheVersion = 1;
+
+struct CacheHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t Endian; //0x01020304 as written by the machine
+	uint64_t PayloadSize;
+	uint64_t Checksum;
+	int64_t FileSize[InputFileCount]; //-1 if the file is missing
+	int64_t FileTime[InputFileCount];
+};
+
+void FileStamp(const char* path, int64_t& size, int64_t& time)
+{
+	struct stat status;
+	size = -1;
+	time = -1;
+	if (stat(path, &status) == 0)
+	{
+		size = status.st_size;
+#ifdef __linux__
+		time = (int64_t)status.st_mtim.tv_sec*1000000000 + status.st_mtim.tv_nsec;
+#else
+		time = status.st_mtime;
+#endif
+	}
+}
+
+/*Checksum of 8-byte words: the arrays are padded to 8 bytes, so the words never straddle two arrays*/
+inline uint64_t BinaryChecksum(uint64_t hash, const char* data, size_t size)
+{
+	for (size_t k = 0; k + 8 <= size; k += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + k, 8);
+		hash = (hash ^ word) * 0x100000001B3ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+struct BinaryWriter
+{
+	ofstream& File;
+	uint64_t Size;
+	uint64_t Checksum;
+
+	BinaryWriter(ofstream& file) : File(file), Size(0), Checksum(0xCBF29CE484222325ULL) {}
+
+	void Write(const char* data, size_t size)
+	{
+		static const char zeros[8] = {0};
+		File.write(data, size);
+		size_t padding = (8 - size % 8) % 8;
+		File.write(zeros, padding);
+		Checksum = BinaryChecksum(Checksum, data, size - size % 8);
+		if (padding != 0)
+		{
+			char last[8] = {0};
+			memcpy(last, data + size - size % 8, size % 8);
+			Checksum = BinaryChecksum(Checksum, last, 8);
+		}
+		Size += size + padding;
+	}
+
+	static const bool Reading = 0;
+
+	template <typename V> void operator()(V& values)
+	{
+		uint64_t count = values.size();
+		Write(reinterpret_cast<const char*>(&count), sizeof(count));
+		if (count != 0){Write(reinterpret_cast<const char*>(values.data()), count*sizeof(values[0]));}
+	}
+
+	template <typename T> void Scalar(T& value) {Write(reinterpret_cast<const char*>(&value), sizeof(value));}
+};
+
+struct BinaryReader
+{
+	const char* Position;
+	const char* End;
+
+	static const bool Reading = 1;
+
+	template <typename V> void operator()(V& values)
+	{
+		typedef typename V::value_type T;
+		uint64_t count;
+		if (End - Position < 8){throw runtime_error("truncated");}
+		memcpy(&count, Position, 8);
+		Position += 8;
+		uint64_t bytes = count*sizeof(T);
+		if ((uint64_t)(End - Position) < bytes){throw runtime_error("truncated");}
+		values.resize(count);
+		if (count != 0){memcpy(values.data(), Position, bytes);}
+		Position += (bytes + 7)/8*8;
+	}
+
+	template <typename T> void Scalar(T& value)
+	{
+		if ((size_t)(End - Position) < sizeof(T)){throw runtime_error("truncated");}
+		memcpy(&value, Position, sizeof(T));
+		Position += (sizeof(T) + 7)/8*8;
+	}
+};
+
+/*The arrays of the network, in the order of the cache*/
+template <typename Archive> void Network::Arrays(Archive& archive)
+{
+	archive(FirmIDs);
+	for (CSRLinks* links : {&OutLinks, &InLinks})
+	{
+		archive(links->Start);
+		archive(links->Firm);
+		archive(links->Weight);
+		archive(links->InvWeight);
+		archive(links->Sector);
+		archive(links->Twin);
+	}
+	archive(LinkS);
+	archive(LinkC);
+	for (Column<double>* column : {&Profile.Pini, &Profile.C, &Profile.ProfitToSales, &Profile.TotalOutput, &Profile.TotalInput, &Profile.Deposit, &Profile.OA,
+			&Profile.Loan, &Profile.Equity, &Profile.OL, &Profile.Clusters, &Profile.Knn})
+	{
+		archive(*column);
+	}
+	for (Column<int>* column : {&Profile.IOSector, &Profile.Sector, &Profile.Location, &Profile.Community})
+	{
+		archive(*column);
+	}
+	archive(Profile.Active);
+	archive(Sectors.Start);
+	archive(Sectors.Sector);
+	archive(Sectors.Slot);
+	archive(Sectors.Aij);
+	archive(Accounts.Start);
+	archive(Accounts.Bank);
+	archive(Accounts.Balance);
+	archive(Accounts.Banks);
+	for (FirmGroups* groups : {&LocationFirms, &SectorFirms, &CommunityFirms})
+	{
+		archive(groups->Key);
+		archive(groups->Start);
+		archive(groups->Firm);
+	}
+}
+
+void Network::SaveCache(const std::string& path)
+{
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, CacheMagic, 8);
+	header.Version = CacheVersion;
+	header.Endian = 0x01020304;
+	for (int f = 0; f < InputFileCount; f++){FileStamp(InputPath(InputFiles[f]).c_str(), header.FileSize[f], header.FileTime[f]);}
+
+	/*The file is written under a temporary name and renamed once complete, so a run never sees a partial cache*/
+	std::string temporary = path + ".tmp";
+	ofstream file(temporary, ios::binary);
+	if (!file){throw runtime_error(path + ": cannot write the network cache");}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	BinaryWriter writer(file);
+	Arrays(writer);
+	header.PayloadSize = writer.Size;
+	header.Checksum = writer.Checksum;
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.close();
+	if (!file){throw runtime_error(path + ": cannot write the network cache");}
+	std::remove(path.c_str());
+	if (std::rename(temporary.c_str(), path.c_str()) != 0){throw runtime_error(path + ": cannot write the network cache");}
+}
+
+/*This function loads the network from the cache; it returns 0 if the cache is missing, corrupted or older than the input files*/
+bool Network::LoadCache(const std::string& path)
+{
+	MappedFile file(path);
+	if ((size_t)(file.End - file.Begin) < sizeof(CacheHeader)){return 0;}
+	CacheHeader header;
+	memcpy(&header, file.Begin, sizeof(header));
+	if ((memcmp(header.Magic, CacheMagic, 8) != 0) or (header.Version != CacheVersion) or (header.Endian != 0x01020304)){return 0;}
+	for (int f = 0; f < InputFileCount; f++)
+	{
+		int64_t size, time;
+		FileStamp(InputPath(InputFiles[f]).c_str(), size, time);
+		if ((size != header.FileSize[f]) or (time != header.FileTime[f])){return 0;}
+	}
+	const char* payload = file.Begin + sizeof(header);
+	if ((uint64_t)(file.End - payload) != header.PayloadSize){return 0;}
+	if (BinaryChecksum(0xCBF29CE484222325ULL, payload, header.PayloadSize) != header.Checksum){return 0;}
+
+	BinaryReader reader;
+	reader.Position = payload;
+	reader.End = file.End;
+	try
+	{
+		Arrays(reader);
+	}
+	catch (const runtime_error&)
+	{
+		*this = Network();
+		return 0;
+	}
+	return 1;
+}
+
+/*This function returns the dense index of a firm ID, or -1 if the firm is not in the production network*/
+int Network::FirmIndex(int ID) const
+{
+	vector<int>::const_iterator itr = std::lower_bound(FirmIDs.begin(), FirmIDs.end(), ID);
+	if ((itr == FirmIDs.end()) or (*itr != ID)){return -1;}
+	return itr - FirmIDs.begin();
+}
+
+void Network::Load()
+{
+	/*
+	 * Upload network data
+	 * Each file is read once into a table; the format gives the columns read: i: integer; d: real; -: skipped.
+	*/
+
+	/*
+	 * File structure: supplier - customer - weight (Aij) - sector of supplier - location of supplier- sector of customer - location of customer - final goods (consumption Ci of supplier) - final goods (consumption Ci of customer)
+	 * This part upload data from the file InOutput.dat (OutLinks and InLinks)
+	 * The links are read first.
+	 * The firms of the production network are all the suppliers and customers of the links: their IDs are remapped to dense indices sorted by ID.
+	 * The other files are then loaded directly in the columns of the firm profile; lines of firms outside the network are skipped.
+	*/
+	Table links = ReadTable(InputPath(LinksFile), "iid");
+	int L = links.Rows();
+	vector<int> LinkSupplier(L), LinkCustomer(L);
+	vector<double> LinkWeight(L);
+	for (int l = 0; l < L; l++)
+	{
+		LinkSupplier[l] = links.Int(l, 0);
+		LinkCustomer[l] = links.Int(l, 1);
+		LinkWeight[l] = links.Double(l, 2);
+	}
+	Table().Values.swap(links.Values);
+
+	FirmIDs.insert(FirmIDs.end(), LinkSupplier.begin(), LinkSupplier.end());
+	FirmIDs.insert(FirmIDs.end(), LinkCustomer.begin(), LinkCustomer.end());
+	std::sort(FirmIDs.begin(), FirmIDs.end());
+	FirmIDs.erase(std::unique(FirmIDs.begin(), FirmIDs.end()), FirmIDs.end());
+	int N = FirmIDs.size();
+	Profile.Resize(N);
+
+	Table stats = ReadTable(InputPath(ClustersFile), "idd"); //ID - clusters - knn
+	for (int r = 0; r < stats.Rows(); r++)
+	{
+		int i = FirmIndex(stats.Int(r, 0));
+		if (i == -1){continue;}
+		Profile.Clusters[i] = stats.Double(r, 1);
+		Profile.Knn[i] = stats.Double(r, 2);
+	}
+
+	Table profit = ReadTable(InputPath(ProfitFile), "id"); //ID - ratio
+	for (int r = 0; r < profit.Rows(); r++)
+	{
+		int i = FirmIndex(profit.Int(r, 0));
+		if (i != -1){Profile.ProfitToSales[i] = profit.Double(r, 1);}
+	}
+
+	Table location = ReadTable(InputPath(LocationFile), "ii"); //ID - prefecture
+	for (int r = 0; r < location.Rows(); r++)
+	{
+		int i = FirmIndex(location.Int(r, 0));
+		if (i != -1){Profile.Location[i]=location.Int(r, 1);}
+	}
+
+	Table sector = ReadTable(InputPath(SectorFile), "i--i"); //ID - index - sector - new index - new sector
+	for (int r = 0; r < sector.Rows(); r++)
+	{
+		int i = FirmIndex(sector.Int(r, 0));
+		if (i != -1){Profile.Sector[i]=sector.Int(r, 1);}
+	}
+
+	Table community = ReadTable(InputPath(CommunityFile), "ii"); //ID - community
+	for (int r = 0; r < community.Rows(); r++)
+	{
+		int i = FirmIndex(community.Int(r, 0));
+		if (i != -1){Profile.Community[i]=community.Int(r, 1);}
+	}
+
+	LocationFirms.Build(Profile.Location);
+	SectorFirms.Build(Profile.Sector);
+	CommunityFirms.Build(Profile.Community);
+
+	/*
+	 * The accounts of each firm are sorted by bank; a firm - bank pair given twice keeps its first line.
+	*/
+	Table bank = ReadTable(InputPath(FirmBankFile), "iidd"); //ID firm - ID bank - loan - deposit
+	vector<int> rows;
+	for (int r = 0; r < bank.Rows(); r++)
+	{
+		Accounts.Banks.push_back(bank.Int(r, 1));
+		if (FirmIndex(bank.Int(r, 0)) != -1){rows.push_back(r);}
+	}
+	std::sort(Accounts.Banks.begin(), Accounts.Banks.end());
+	Accounts.Banks.erase(std::unique(Accounts.Banks.begin(), Accounts.Banks.end()), Accounts.Banks.end());
+	std::stable_sort(rows.begin(), rows.end(), [&](int a, int b) {
+		return (bank.Int(a, 0) < bank.Int(b, 0)) or ((bank.Int(a, 0) == bank.Int(b, 0)) and (bank.Int(a, 1) < bank.Int(b, 1)));
+	});
+	Accounts.Start.assign(N+1, 0);
+	for (size_t k = 0; k < rows.size(); k++)
+	{
+		int r = rows[k];
+		if ((k > 0) and (bank.Int(r, 0) == bank.Int(rows[k-1], 0)) and (bank.Int(r, 1) == bank.Int(rows[k-1], 1))){continue;}
+		Accounts.Bank.push_back(bank.Int(r, 1));
+		Accounts.Balance.push_back(bank.Double(r, 2));
+		Accounts.Balance.push_back(bank.Double(r, 3));
+		Accounts.Start[FirmIndex(bank.Int(r, 0))+1]++;
+	}
+	for (int i = 0; i < N; i++){Accounts.Start[i+1] += Accounts.Start[i];}
+
+	Table bs = ReadTable(InputPath(BalanceSheetFile), "iddddd"); //ID - deposit - OA - loan - equity - OL
+	for (int r = 0; r < bs.Rows(); r++)
+	{
+		int i = FirmIndex(bs.Int(r, 0));
+		if (i == -1){continue;}
+		Profile.Deposit[i] = bs.Double(r, 1);
+		Profile.OA[i] = bs.Double(r, 2);
+		Profile.Loan[i] = bs.Double(r, 3);
+		Profile.Equity[i] = bs.Double(r, 4);
+		Profile.OL[i] = bs.Double(r, 5);
+	}
+
+	vector<char> HasC(N, 0);
+	Table consumption = ReadTable(InputPath(ConsumptionFile), "id"); //ID - Ci
+	for (int r = 0; r < consumption.Rows(); r++)
+	{
+		int i = FirmIndex(consumption.Int(r, 0));
+		if (i != -1)
+		{
+			Profile.C[i] = consumption.Double(r, 1);
+			HasC[i] = 1;
+		}
+	}
+
+	/*
+	 * Firms which have a Pini are active; the others don't produce and only submit constant orders equal to initial input
+	*/
+	Table production = ReadTable(InputPath(ProductionFile), "id"); //ID - Pini
+	for (int r = 0; r < production.Rows(); r++)
+	{
+		int i = FirmIndex(production.Int(r, 0));
+		if ((i != -1) and (HasC[i] == 1))
+		{
+			Profile.Pini[i]= production.Double(r, 1);
+			Profile.Active[i] = 1;
+		}
+	}
+
+	/*
+	 * Sector of each firm of the network; firms without sector in the list of firms are in sector 0
+	*/
+	Table list = ReadTable(InputPath(SectorListFile), "ii"); //ID - sector
+	for (int r = 0; r < list.Rows(); r++)
+	{
+		int i = FirmIndex(list.Int(r, 0));
+		if ((i != -1) and (HasC[i] == 1))
+		{Profile.IOSector[i] = list.Int(r, 1);}
+	}
+
+	/*
+	 * Build the CSR out links and in links.
+	 * Links are sorted by (supplier, customer); a duplicated link keeps the weight of its first occurrence in the file.
+	*/
+	LinkS.resize(L);
+	LinkC.resize(L);
+	vector<int> Order(L);
+	for (int l = 0; l < L; l++)
+	{
+		LinkS[l] = FirmIndex(LinkSupplier[l]);
+		LinkC[l] = FirmIndex(LinkCustomer[l]);
+		Order[l] = l;
+	}
+	std::stable_sort(Order.begin(), Order.end(), [&](int a, int b) {
+		return (LinkS[a] < LinkS[b]) or ((LinkS[a] == LinkS[b]) and (LinkC[a] < LinkC[b]));
+	});
+	vector<int> Unique;
+	for (int k = 0; k < L; k++)
+	{
+		int l = Order[k];
+		if (Unique.empty() or (LinkS[Unique.back()] != LinkS[l]) or (LinkC[Unique.back()] != LinkC[l])){Unique.push_back(l);}
+	}
+	int E = Unique.size();
+
+	OutLinks.Start.assign(N+1, 0);
+	InLinks.Start.assign(N+1, 0);
+	for (int k = 0; k < E; k++)
+	{
+		OutLinks.Start[LinkS[Unique[k]]+1]++;
+		InLinks.Start[LinkC[Unique[k]]+1]++;
+	}
+	for (int i = 0; i < N; i++)
+	{
+		OutLinks.Start[i+1] += OutLinks.Start[i];
+		InLinks.Start[i+1] += InLinks.Start[i];
+	}
+	for (CSRLinks* links : {&OutLinks, &InLinks})
+	{
+		links->Firm.resize(E);
+		links->Weight.resize(E);
+		links->InvWeight.resize(E);
+		links->Sector.resize(E);
+		links->Twin.resize(E);
+	}
+	vector<int> InFill(InLinks.Start.begin(), InLinks.Start.end()-1);
+	for (int k = 0; k < E; k++)
+	{
+		int l = Unique[k];
+		int s = LinkS[l];
+		int c = LinkC[l];
+		int f = InFill[c]++;
+
+		OutLinks.Firm[k] = c;
+		OutLinks.Weight[k] = LinkWeight[l];
+		OutLinks.InvWeight[k] = 1/LinkWeight[l];
+		OutLinks.Sector[k] = Profile.IOSector[c];
+		OutLinks.Twin[k] = f;
+
+		InLinks.Firm[f] = s;
+		InLinks.Weight[f] = LinkWeight[l];
+		InLinks.InvWeight[f] = 1/LinkWeight[l];
+		InLinks.Sector[f] = Profile.IOSector[s];
+		InLinks.Twin[f] = k;
+	}
+
+	for (int i = 0; i < N; i++)
+	{
+		if (OutLinks.Start[i+1] == OutLinks.Start[i]){continue;}
+		double output = 0;
+		for (int e = OutLinks.Start[i]; e < OutLinks.Start[i+1]; e++)
+		{
+			output += OutLinks.Weight[e];
+		}
+		Profile.TotalOutput[i] = output+Profile.C[i];
+	}
+
+	/*
+	 * The sector inventory of each firm has one position per sector of its suppliers
+	*/
+	Sectors.Start.assign(N+1, 0);
+	Sectors.Slot.assign(E, 0);
+	for (int i = 0; i < N; i++)
+	{
+		vector<int> sectors(InLinks.Sector.begin()+InLinks.Start[i], InLinks.Sector.begin()+InLinks.Start[i+1]);
+		std::sort(sectors.begin(), sectors.end());
+		sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+		for (int e = InLinks.Start[i]; e < InLinks.Start[i+1]; e++)
+		{
+			Sectors.Slot[e] = Sectors.Sector.size() + (std::lower_bound(sectors.begin(), sectors.end(), InLinks.Sector[e]) - sectors.begin());
+		}
+		Sectors.Sector.insert(Sectors.Sector.end(), sectors.begin(), sectors.end());
+		Sectors.Start[i+1] = Sectors.Sector.size();
+	}
+	Sectors.Aij.assign(Sectors.Sector.size(), 0);
+
+	for (int i = 0; i < N; i++)
+	{
+		if (InLinks.Start[i+1] == InLinks.Start[i]){continue;}
+		double input = 0;
+		for (int e = InLinks.Start[i]; e < InLinks.Start[i+1]; e++)
+		{
+			input += InLinks.Weight[e];
+			Sectors.Aij[Sectors.Slot[e]] += InLinks.Weight[e];
+		}
+
+		Profile.TotalInput[i] = input;
+	}
+
+}
+
+Simulation::Simulation(const Network& network, int replication, uint64_t seed)
+	: Replication(replication), Seed(seed), DamageRandom(seed, replication, DamageDraws), Net(network), FirmIDs(network.FirmIDs), OutLinks(network.OutLinks), InLinks(network.InLinks),
+	  Profile(network.Profile), Sectors(network.Sectors), Accounts(network.Accounts)
+{
+}
+
+/*
+ * A replication starts from a copy of the state at t = 0, before any random draw: the copy of the columns is the whole cost of its start.
+*/
+Simulation::Simulation(const Simulation& snapshot, int replication)
+	: Simulation(snapshot)
+{
+	Replication = replication;
+	DamageRandom = RandomStream(Seed, replication, DamageDraws);
+}
+
+void Simulation::Initial_Data()
+{
+	n = 15;
+	tau = 6;
+	t = 0;
+	disaster = 0;
+	StationaryDays = 0;
+	Residual.assign(FirmIDs.size(), 0.0);
+	HelpFirms = 1;
+	GammaMin = 0.001;
+	GammaMax = 0.004;
+	NumberDamagedFirms = 0.03;
+	DamageMagnitude = 0.512040958832949;
+	LimitSolvencyRatio = 0.034;
+	StartRecover = 5; //Number of days before starting recovery
+	LoanMaturity = 53; //The maturity of all loans in number of days
+	LTLoanMaturity = 399;
+	WithPayment = 1; //Model with payment from customers to suppliers or not
+	ShortLoans = 1; //Model with short term loans given by banks to firms or not
+	LTLoansModel = 1; //Model with short term loans given by banks to firms or not
+	ShortInterestRate = 1; //Model with 0 short term interest rate or not
+	LimitToDefault = 10; //Number of day without payment before declaring loan default
+	BankRiskManager = 1; //If 1 the bank is a risk manager; 0: the bank has no risk policy in case of disaster; Give priority of the economic recovery
+	location_of_disaster = 35; //35: Tokyo, 52: Kyoto, 53: Osaka, 54: Hyogo; 48: Aichi
+	sector_of_disaster = 3111;
+	community_of_disaster = 2;
+	DisasterScenario = 0; //0: Random Selection from the whole network; 1: Random selection from one prefecture ; 2: Random selection from one sector; 3: Random selection from one community
+
+	GNPL = 0;
+	GDeposit = 0;
+	GLoan = 0;
+	GEquity = 0;
+    RateNPL = 0;
+	CountNPL = 0;
+	GvtSupport = 0;
+	/*
+	 * Initialize all economic variables from the shared network: price, demand, balance sheets...
+	 * Initialization of the price: All firms have the same initial price: P0 = 1
+	 * The inventories depend on random draws: they are set by each replication in Draw_Inventory.
+	*/
+	int N = FirmIDs.size();
+	int E = InLinks.Firm.size();
+	Firm.Resize(N);
+	if (ValueAddedHistory != 0){ValueAdded.Current.assign(N, 0.0);}
+	Firm.Deposit.assign(Profile.Deposit.begin(), Profile.Deposit.end());
+	Firm.Loan.assign(Profile.Loan.begin(), Profile.Loan.end());
+	Firm.Equity.assign(Profile.Equity.begin(), Profile.Equity.end());
+	for (int i = 0; i < N; i++)
+	{
+		if (Profile.Active[i]){Firm.rzDemand[i] = Profile.Pini[i];}
+	}
+
+	for (size_t b = 0; b < Accounts.Banks.size(); b++)
+	{
+		BankNPLH[Accounts.Banks[b]] = {0,0};
+		BankLoanDepositH[Accounts.Banks[b]] = {0,0};
+	}
+
+	int A = Accounts.Bank.size();
+	Loans.Head.assign(A, -1);
+	Loans.Tail.assign(A, -1);
+	Loans.Opened.assign(A, 0);
+	Loans.Balance = Accounts.Balance;
+	Loans.PayByLoan.assign(A, 0);
+	Loans.NPL.assign(A, 0);
+
+	dOrdersV.assign(E, 0);
+	rOrdersV.assign(E, 0);
+	rReturnedV.assign(E, 0);
+	rcDemandFirmLevelV.assign(E, 0);
+	fInventoryV.assign(E, 0);
+	AccfInventoryV.assign(E, 0);
+	Stock.Inventory.assign(Sectors.Sector.size(), 0);
+	Stock.AccInventory.assign(Sectors.Sector.size(), 0);
+	Frontier.Resize(N, E);
+
+	for (int i = 0; i < N; i++)
+	{
+		if (InLinks.Start[i+1] == InLinks.Start[i]){continue;}
+		Firm.Deposit[i]=Profile.TotalInput[i];
+		Firm.Equity[i]=Firm.Deposit[i]+Profile.OA[i]-Firm.Loan[i]-Profile.OL[i];
+	}
+
+}
+
+void Simulation::Set_Parameter(int index, double value)
+{
+	const SimulationParameter& parameter = ModelParameters[index];
+	if (parameter.Integer){this->*parameter.Integer = (int)value;}
+	else {this->*parameter.Real = value;}
+}
+
+void Simulation::Draw_Inventory()
+{
+	/*
+	 * Initialize the Inventory at firm level: suppose that the inventory at t = 0 is the amount of initial trade Aij.
+	*/
+	int N = FirmIDs.size();
+	int L = Net.LinkS.size();
+
+	/*
+	 * The number of days of inventory is drawn for both ends of each link, in the order of the file: the draw 2l is the customer of the line l, the draw 2l+1 its supplier.
+	 * The draws are independent, so they are made in parallel; the last line of a firm gives its number of days.
+	*/
+	PoissonTable poisson;
+	poisson.Build(n);
+	RandomStream days_random(Seed, Replication, DaysDraws);
+	vector<int> draws(2*L);
+	#pragma omp parallel for schedule(static)
+	for (int d = 0; d < 2*L; d++)
+	{
+		draws[d] = poisson.Draw(days_random.Uniform(d));
+	}
+	for (int l = 0; l < L; l++)
+	{
+	    Firm.Days[Net.LinkC[l]] = draws[2*l];
+	    Firm.Days[Net.LinkS[l]] = draws[2*l+1];
+	}
+
+	for (int i = 0; i < N; i++)
+	{
+		for (int e = InLinks.Start[i]; e < InLinks.Start[i+1]; e++)
+		{
+			fInventoryV[e] = (double)Firm.Days[i]*InLinks.Weight[e];
+			Stock.Inventory[Sectors.Slot[e]] += (double)Firm.Days[i]*InLinks.Weight[e];
+		}
+	}
+}
+
+double Simulation::Scale(double min, double max, double x)
+{
+    double number;
+    number = (GammaMax - GammaMin)*(x - min)/(max - min) + GammaMin;
+    return number;
+}
+
+void Simulation::Desired_Goods()
+{
+	/*
+	 * 1- Each firm defines its desired orders to each of its suppliers in dOrdersV (by in link).
+	 * 2- Each supplier gathers the orders of its clients through its out links and defines its received demand in Firm.rcDemand
+	 * Each firm only writes its own links and variables, so both loops run in parallel without locks and give the same result for any number of threads.
+	*/
+	int N = FirmIDs.size();
+
+	#pragma omp parallel for schedule(dynamic, 256)
+    for (int c = 0; c < N; c++)
+    {
+		Firm.GROrders[c] = 0;
+		Firm.Expenses[c] = 0;
+		if ((Frontier.Full == 0) and (Frontier.OrdersInput[c] == 0))
+		{
+			Frontier.OrdersChanged[c] = 0;
+			continue;
+		}
+		bool changed = Frontier.Full;
+		double orders = 0;
+        for (int e = InLinks.Start[c]; e < InLinks.Start[c+1]; e++)
+        {
+            double order_ij = 0;
+            if (Profile.Active[c])
+            {
+                double quantity = InLinks.Weight[e]*Firm.rzDemand[c]/Profile.Pini[c];
+                if(almost_equal((double)Firm.Days[c]*quantity , fInventoryV[e]))
+                {
+                    order_ij = quantity;
+                }
+                else if ((double)Firm.Days[c]*quantity < fInventoryV[e])
+                {
                      order_ij = quantity;
                 }
-                else if ((double)DaysH[(*itC).first]*quantity > fInventoryHoH[(*itC).first][(*itS).first][0])
+                else if ((double)Firm.Days[c]*quantity > fInventoryV[e])
                 {
-                    order_ij = quantity +  ((double)DaysH[(*itC).first]*quantity - fInventoryHoH[(*itC).first][(*itS).first][0])/(double)tau;
+                    order_ij = quantity +  ((double)Firm.Days[c]*quantity - fInventoryV[e])/(double)tau;
                 }
                 if (order_ij < 0.0){order_ij = 0;}
             }
             else
             {
-            	order_ij = InPutFirmHoH[(*itC).first][(*itS).first][0];
+            	order_ij = InLinks.Weight[e];
             }
-           	rcDemandVectorH[(*itS).first]+=order_ij;
-           	rcDemandFirmLevelH[(*itS).first][(*itC).first] = order_ij;
-           	dOrdersH[(*itC).first]+=order_ij;
+            if (Same(dOrdersV[e], order_ij) == 0){changed = 1;}
+           	dOrdersV[e] = order_ij;
+           	orders+=order_ij;
         }
+        Firm.dOrders[c] = orders;
+        Frontier.OrdersChanged[c] = changed;
+    }
+
+	/*The initial value of the received demand is equal to the final consumption*/
+	#pragma omp parallel for schedule(dynamic, 256)
+	for (int s = 0; s < N; s++)
+	{
+		bool changed = Frontier.Full;
+		for (int e = OutLinks.Start[s]; (e < OutLinks.Start[s+1]) and (changed == 0); e++)
+		{
+			if (Frontier.OrdersChanged[OutLinks.Firm[e]]){changed = 1;}
+		}
+		if (changed == 0)
+		{
+			Frontier.DemandChanged[s] = 0;
+			continue;
+		}
+
+		changed = Frontier.Full;
+		double demand = Profile.C[s];
+		for (int e = OutLinks.Start[s]; e < OutLinks.Start[s+1]; e++)
+		{
+			double order_ij = dOrdersV[OutLinks.Twin[e]];
+			if (Same(rcDemandFirmLevelV[e], order_ij) == 0){changed = 1;}
+			rcDemandFirmLevelV[e] = order_ij;
+			demand+=order_ij;
+		}
+		if (Same(Firm.rcDemand[s], demand) == 0){changed = 1;}
+		Firm.rcDemand[s] = demand;
+		Frontier.DemandChanged[s] = changed;
+	}
+}
+
+/*This procedure marks the firm i as damaged*/
+inline double Simulation::Damage(int i)
+{
+	DamagedFirmsH.insert(i);
+	Firm.Damaged[i] = 1;
+	Firm.Delta[i] = DamageMagnitude;
+	Firm.LTLoans[i] = Profile.Pini[i]*DamageMagnitude;
+	return Firm.Deposit[i]/(Profile.Pini[i]*DamageMagnitude);
+}
+
+void Simulation::DamagedFirms()
+{
+	/*
+	 * Random selection of X% of firms as damaged, without replacement, among the firms of the disaster scenario
+	 * Damaged firms are saved in the set DamagedFirmsH (dense indices)
+	 * The selection is a partial Fisher-Yates shuffle of the group: only the swapped positions are kept, so selecting k firms costs O(k).
+	*/
+	int total_size = FirmIDs.size();
+	int target = std::ceil(NumberDamagedFirms*total_size);
+	double min = 0.0;
+	double max = 0.0;
+
+	const FirmGroups* buckets = 0; //0: the whole network
+	int key = 0;
+	std::string name = "network";
+	if (DisasterScenario == 1){buckets = &Net.LocationFirms; key = location_of_disaster; name = "prefecture";}
+	else if (DisasterScenario == 2){buckets = &Net.SectorFirms; key = sector_of_disaster; name = "sector";}
+	else if (DisasterScenario == 3){buckets = &Net.CommunityFirms; key = community_of_disaster; name = "community";}
+	else if (DisasterScenario != 0)
+	{
+		throw runtime_error("DamagedFirms: unknown DisasterScenario " + to_string(DisasterScenario));
+	}
+
+	const int* group = 0; //0: the firm at position r of the group is the firm r
+	int size = total_size;
+	if (buckets != 0){group = buckets->Find(key, size);}
+	if (size < target)
+	{
+		throw runtime_error("DamagedFirms: the " + name + " " + to_string(key) + " of DisasterScenario " + to_string(DisasterScenario) + " has "
+				+ to_string(size) + " firms, less than the " + to_string(target) + " firms to damage (NumberDamagedFirms " + to_string(NumberDamagedFirms) + " of " + to_string(total_size) + " firms)");
+	}
+
+	unordered_map<int, int> swapped; //Position in the group -> position of the firm moved there
+	for (int j = 0; j < target; j++)
+	{
+		int r = j + DamageRandom.Next() % (size - j);
+		unordered_map<int, int>::iterator at_r = swapped.find(r);
+		unordered_map<int, int>::iterator at_j = swapped.find(j);
+		int picked = (at_r != swapped.end()) ? (*at_r).second : r;
+		int moved = (at_j != swapped.end()) ? (*at_j).second : j;
+		swapped[r] = moved;
+
+		int i = (group != 0) ? group[picked] : picked;
+		double recover = Damage(i);
+		if (min < recover){min = recover;}
+		if (max > recover){max = recover;}
+	}
+	for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+	{
+		double recover = Firm.Deposit[*it]/(Profile.Pini[*it]*DamageMagnitude);
+		Firm.Recovery[*it] = Scale(min,max,recover);
+	}
+}
+
+
+void Simulation::ProductionInoue18(int i)
+{
+	/*
+	 * The production function for one firm i
+	 * This production function is a reproduction of Inoue and Todo (2018)
+	*/
+	PROFILE_CALL(PhaseProduction);
+    double Pcap;
+    double minPproi;
+    double Pmax;
+
+    /* Calculate the capacity of production after disaster Equation (4) */
+	if (Firm.Damaged[i])
+	{
+		if (t < StartRecover){Pcap = (1-Firm.Delta[i])*Profile.Pini[i];}
+		else
+		{
+			if (Firm.Delta[i]!=0.0){Firm.Delta[i] = (1-Firm.Recovery[i])*Firm.Delta[i];}
+			Pcap = (1-Firm.Delta[i])*Profile.Pini[i];
+		}
+	}
+	else
+	{
+		Pcap = Profile.Pini[i];
+	}
+
+    /*Calculate the production under inventory constraint Equation (7)*/
+	int k = Sectors.Start[i];
+	int size = Sectors.Start[i+1] - k;
+	if (size == 0){minPproi = Profile.Pini[i];}
+	else {minPproi = MinPproi(Profile.Pini[i], &Stock.Inventory[k], &Sectors.Aij[k], size);}
+
+	/*Calculate the real actual production of the firm equations (8 and 9)*/
+	Pmax = std::min(Pcap,minPproi);
+	Firm.Pact[i]= std::min(Pmax,Firm.rcDemand[i]);
+}
+
+/*
+ * This procedure delivers a quantity of goods through the out link e: realized orders and new inventory of the customer at the firm level.
+ * Only the slots of the link are written, so suppliers can trade in parallel; the customers collect their deliveries in Receive_Goods.
+*/
+inline void Simulation::Deliver(int e, double quantity)
+{
+	int f = OutLinks.Twin[e];
+	rOrdersV[f] += quantity;
+	AccfInventoryV[f] += quantity;
+	Frontier.Delivered[f] = quantity;
+}
+
+/*
+ * Work arrays of the rationing.
+ * There is one set per thread, so that suppliers are rationed in parallel without allocation.
+*/
+struct RationingBuffers
+{
+	vector<double> Ratio; // pre-to-post disaster ratio
+	vector<double> Weight; // initial orders
+	vector<double> Level; // level at which the client left the rationing; -1 while it is served
+	vector<int> Order;
+};
+
+thread_local RationingBuffers RationingWork;
+
+void Simulation::Rationing(int i)
+{
+	/*
+	 * 1- Each supplier i decided about his production level.
+	 * 2- If the production is less than the received demand: Rationing policy as in Inoue and Todo (2018).
+	 * 3- Fill in these data structures: rOrdersV, Firm.rzDemand, AccfInventoryV, Stock.AccInventory.
+	 * The rationing is a water-filling over the pre-to-post disaster ratios of orders:
+	 * all clients receive the same share of their initial orders, the level rises until the clients with the smallest ratio are satisfied,
+	 * these clients leave and the level continues to rise for the others until the production is exhausted.
+	 * The clients are sorted once by ratio, so a supplier with k clients costs O(k log k).
+	 * Clients 0..k-1 are the out links of firm i; client k is the household.
+	*/
+	PROFILE_CALL(PhaseRationing);
+	int begin = OutLinks.Start[i];
+	int k = OutLinks.Start[i+1] - begin;
+	int m = k + 1;
+	vector<double>& Ratio = RationingWork.Ratio;
+	vector<double>& Weight = RationingWork.Weight;
+	vector<double>& Level = RationingWork.Level;
+	vector<int>& Order = RationingWork.Order;
+	Ratio.resize(m);
+	Weight.resize(m);
+	Level.assign(m, -1);
+	Order.resize(m);
+
+	Firm.rzDemand[i]=0.0; // Initialize the realized demand of the supplier
+    /*Calculate the pre-to-disaster ratio of orders of all clients of firm i*/
+	for (int j = 0; j < k; j++)
+	{
+		int e = begin + j;
+		Ratio[j] = rcDemandFirmLevelV[e]*OutLinks.InvWeight[e];
+		Weight[j] = OutLinks.Weight[e];
+	    rOrdersV[OutLinks.Twin[e]] = 0; /*Initialize the realized orders variable*/
+	}
+	Ratio[k] = 1; //Ratio of the household consumption which is always constant.
+	Weight[k] = Profile.C[i];
+
+	for (int j = 0; j < m; j++){Order[j] = j;}
+	std::stable_sort(Order.begin(), Order.end(), [&](int a, int b) {
+		return (Ratio[a] < Ratio[b]) or ((std::isnan(Ratio[a]) == 0) and std::isnan(Ratio[b]));
+	});
+
+	double sum_weights = 0; // initial orders of the clients still served
+	double sum_orders_first = 0; // desired orders of the clients still served
+	for (int j = 0; j < m; j++)
+	{
+		sum_weights+=Weight[j];
+		sum_orders_first+=Ratio[j]*Weight[j];
+	}
+
+	double level = 0.0;
+	double extra_ratio = 0.0; // share of the initial orders given on top of the level to the clients still served
+	bool satisfied = 0; // 1 if the clients still served receive all their desired orders
+	int next = 0; // position in Order of the client with the smallest ratio still served
+	int served = m;
+	double firm_production = Firm.Pact[i];
+
+	while((almost_equal(firm_production,0.0) == 0) and (firm_production > 0.0) and (served > 1)) /*While firm i has a production, it continues satisfying orders*/
+	{
+		if(disaster == 0)
+		{
+			extra_ratio = 1;
+			firm_production = 0.0;
+		}
+
+		double remaining_orders = sum_orders_first - level*sum_weights;
+		if((firm_production > remaining_orders) || (almost_equal(firm_production,remaining_orders)==1))
+		{
+			satisfied = 1;
+			break;
+		}
+		if (firm_production == 0.0){break;}
+
+		double step = Ratio[Order[next]] - level;
+		if (step*sum_weights > firm_production)
+		{
+			extra_ratio = firm_production/sum_weights;
+			break;
+		}
+
+		/*All clients still served receive the step; the clients reaching their ratio leave*/
+		firm_production-=step*sum_weights;
+		level+=step;
+		do
+		{
+			int j = Order[next];
+			Level[j] = level;
+			sum_weights-=Weight[j];
+			sum_orders_first-=Ratio[j]*Weight[j];
+			served--;
+			next++;
+		}
+		while((next < m) and (Ratio[Order[next]] - level < epsilon2));
+	}
+
+	for (int j = 0; j < m; j++)
+	{
+		double quantity;
+		if (Level[j] != -1){quantity = Level[j]*Weight[j];}
+		else if (satisfied){quantity = (Ratio[j] + extra_ratio)*Weight[j];}
+		else {quantity = (level + extra_ratio)*Weight[j];}
+
+		if (j < k){Deliver(begin + j, quantity);}
+		Firm.rzDemand[i]+=quantity;
+	}
+}
+
+void Simulation::RationingCustomers(int i)
+{
+	Firm.rzDemand[i]=0.0;
+
+	if(Firm.Pact[i]>Profile.C[i])
+	{
+		Firm.rzDemand[i]+=Profile.C[i];
+	}
+
+	else
+	{
+		Firm.rzDemand[i]+=Firm.Pact[i];
+	}
+}
+
+void Simulation::Trading(int i)
+{
+	PROFILE_CALL(PhaseTrading);
+	if (almost_equal2(Firm.Pact[i] , Firm.rcDemand[i])==0)
+	{
+		PROFILE_EVENT(EventRationedFirms);
+		if (OutLinks.Start[i+1] == OutLinks.Start[i])
+		{
+			RationingCustomers(i);
+		}
+		else
+		{
+			Rationing(i);
+		}
+	}
+
+	else
+	{
+		Firm.rzDemand[i]=Profile.C[i]; //Ci: consumption for households
+        double rc;
+		for (int e = OutLinks.Start[i]; e < OutLinks.Start[i+1]; e++)
+		{
+			rc = rcDemandFirmLevelV[e];
+			rOrdersV[OutLinks.Twin[e]] = 0;
+			Deliver(e, rc);
+			Firm.rzDemand[i]+=rc;
+		}
+	}
+
+	Frontier.Sales[i] = Firm.rzDemand[i];
+	Firm.Deposit[i]+=Profile.ProfitToSales[i]*Firm.rzDemand[i];
+}
+
+/*
+ * The trading of a firm whose production and received demand didn't change: the deliveries of its last trading are made again.
+*/
+void Simulation::Replay_Trading(int i)
+{
+	PROFILE_CALL(PhaseReplayTrading);
+	if (almost_equal2(Firm.Pact[i], Firm.rcDemand[i]) == 0){PROFILE_EVENT(EventRationedFirms);}
+	Firm.rzDemand[i] = Frontier.Sales[i];
+	for (int e = OutLinks.Start[i]; e < OutLinks.Start[i+1]; e++)
+	{
+		rOrdersV[OutLinks.Twin[e]] = 0;
+		Deliver(e, Frontier.Delivered[OutLinks.Twin[e]]);
+	}
+	Firm.Deposit[i]+=Profile.ProfitToSales[i]*Firm.rzDemand[i];
+}
+
+
+void Simulation::Receive_Goods()
+{
+	/*
+	 * Each customer collects the goods delivered through its in links during the trading:
+	 * the sum of the realized orders and the new inventory at the sector level.
+	 * The deliveries are added in the order of the suppliers, so the result does not depend on the number of threads.
+	*/
+	int N = FirmIDs.size();
+	#pragma omp parallel for schedule(dynamic, 256)
+	for (int c = 0; c < N; c++)
+	{
+		double received = 0;
+		for (int e = InLinks.Start[c]; e < InLinks.Start[c+1]; e++)
+		{
+			received+=rOrdersV[e];
+			Stock.AccInventory[Sectors.Slot[e]]+=rOrdersV[e];
+			rReturnedV[e] = 0;
+		}
+		Firm.GROrders[c] = received;
+	}
+}
+
+void Simulation::CannotPay(int i)
+{
+    /*
+     * Firms who cannot pay are those who could not get a loan.
+     * These firms will try to buy only based on there available deposit.
+     * They try to minimize their expenses.
+     * Only the suppliers which trade (active firms) have delivered goods.
+     * The returned goods are removed from the revenue of the suppliers in Return_Goods.
+    */
+	double Quantity = (Firm.GROrders[i]- Firm.Deposit[i])/Firm.GROrders[i];
+	for (int e = InLinks.Start[i]; e < InLinks.Start[i+1]; e++)
+	{
+		int supplier = InLinks.Firm[e];
+		if (Profile.Active[supplier] == 0){continue;}
+		double order_to_return = rOrdersV[e]*Quantity;
+		rOrdersV[e] -= order_to_return;
+		AccfInventoryV[e] -= order_to_return;
+		Stock.AccInventory[Sectors.Slot[e]]-= order_to_return;
+		rReturnedV[e] = order_to_return;
+		Firm.GROrders[i]-= order_to_return;
+	}
+
+	Firm.Expenses[i]+=Firm.GROrders[i];
+}
+
+void Simulation::LoanDemandSupply(int i, FinanceBlock& block)
+{
+    double TotalLoanDde = Firm.dOrders[i] - Firm.Deposit[i];
+
+    int banks = Accounts.Start[i+1] - Accounts.Start[i];
+    if (banks == 0){return;}
+
+    for(int a = Accounts.Start[i]; a < Accounts.Start[i+1]; a++)
+    {
+    	/*
+    	 * If equity is positive: the firm get loans from all its banks
+    	 * The loan is kept with the requests of the block until the end of the financial phase: the loan book is only modified by Open_Loans
+    	*/
+    	double ln = TotalLoanDde/banks;
+    	double rate = (1 - Firm.Pact[i]/Profile.Pini[i])*0.04;
+    	double periodic = ln/LoanMaturity;
+    	if (ShortInterestRate == 1) {periodic = ln*rate/(1-pow(1+rate,-LoanMaturity));}
+    	NewLoan request;
+    	request.Account = a;
+    	request.Loan.Capital = ln;
+    	request.Loan.Rate = rate;
+    	request.Loan.Periodic = periodic;
+    	request.Loan.Paid = 0;
+    	request.Loan.Missed = 0;
+    	request.Loan.State = 0;
+    	request.Loan.LongTerm = 0; //short-term loan
+    	request.Repaid = 0;
+    	block.Requests.push_back(request);
+    	PROFILE_EVENT(EventLoansIssued);
+    	Loans.Opened[a] = 1;
+    	Loans.PayByLoan[a]=ln;
+
+    	/*
+    	 * After getting loan: Update of the balance sheet
+    	 * 1- Rise the level of loans
+    	 * 2- Rise the level of deposits
+    	*/
+
+    	Firm.Loan[i]+=ln;
+    	Firm.Deposit[i]+=ln;
+
+    	/*
+    	 * Update the accounts of the firm in their banks
+    	*/
+    	Loans.Account(a)[0]+=ln;
+    	Loans.Account(a)[1]+=ln;
+    }
+}
+
+void Simulation::Open_Loans()
+{
+	/*
+	 * The short-term loans given during the financial phase are added to the loan book, in the order of the firms
+	*/
+	for (size_t b = 0; b < Finance.size(); b++)
+	{
+		for (size_t r = 0; r < Finance[b].Requests.size(); r++)
+		{
+			NewLoan& request = Finance[b].Requests[r];
+			if (request.Repaid == 0){Loans.Add(request.Account, request.Loan);}
+		}
+	}
+}
+
+void Simulation::NeedLoan(int i, FinanceBlock& block)
+{
+	PROFILE_CALL(PhaseNeedLoan);
+	if(Firm.dOrders[i] <=  Firm.Deposit[i]){Firm.LoanFlag[i] = 2;}
+	else
+	{
+		if(BankRiskManager == 1)
+		{
+			double TotalLoanDde = Firm.dOrders[i] - Firm.Deposit[i];
+			double risk = (TotalLoanDde + Firm.Loan[i])/(Firm.Equity[i] + TotalLoanDde + Firm.Loan[i]);
+			if(risk < LimitSolvencyRatio)
+			{
+				LoanDemandSupply(i, block);
+				Firm.NoLoans[i] = 0;
+			}
+			else
+			{
+				Firm.NoLoans[i]++;
+				if((Firm.NoLoans[i] > 0) and (HelpFirms == 1))
+				{
+					Firm.Deposit[i]+=TotalLoanDde;
+					block.GvtSupport+=TotalLoanDde;
+					PROFILE_EVENT(EventGvtSupport);
+					Firm.NoLoans[i] = 0;
+				}
+			}
+		}
+
+		else if(BankRiskManager == 2)
+		{
+			if(Firm.Equity[i] > 0.0)
+			{
+				LoanDemandSupply(i, block);
+			}
+		}
+
+		else if(BankRiskManager == 0) {LoanDemandSupply(i, block);}
+
+	}
+}
+
+void Simulation::Payment(int i)
+{
+	PROFILE_CALL(PhasePayment);
+	if ((Firm.Deposit[i] > Firm.GROrders[i]) or (almost_equal2(Firm.Deposit[i],Firm.GROrders[i]) == 1))
+	{
+		double used_deposit = Firm.GROrders[i];
+		//Firm.Deposit[i]-=used_deposit;
+		/*
+		 * After payment, the new deposit is updated as a weight of current loans from each bank
+		*/
+		Firm.Expenses[i]+=Firm.GROrders[i];
+	}
+
+	else
+	{
+		if(Firm.Deposit[i] > 0.0 ){CannotPay(i);}
+		else
+		{
+			for (int e = InLinks.Start[i]; e < InLinks.Start[i+1]; e++)
+			{
+				int supplier = InLinks.Firm[e];
+				if (Profile.Active[supplier] == 0){continue;}
+				rReturnedV[e] = rOrdersV[e];
+				rOrdersV[e] = 0;
+				AccfInventoryV[e] = 0;
+				Stock.AccInventory[Sectors.Slot[e]]= 0;
+				Firm.GROrders[i]= 0;
+			}
+		}
+	}
+}
+
+
+/*
+ * Payment of one loan of the account a of a firm for the current period.
+ * Returns 1 if the loan is totally paid.
+*/
+bool Simulation::Service_Loan(LoanRecord& loan, int a, double* account, double& paid_capital, double& total_amortization, FinanceBlock& block)
+{
+	if((loan.State == 0) or (loan.State == 2))
+	{
+		if(account[1] >= loan.Periodic)
+		{
+			/*
+			 * The current loan level update
+			*/
+			loan.State = 0;
+			double paid_capital_bank = loan.Capital/LoanMaturity;
+			account[0]-=paid_capital_bank;
+			paid_capital+=paid_capital_bank;
+			/*
+			 * Deposits after paying loans
+			*/
+			account[1]-= loan.Periodic;
+			total_amortization+=loan.Periodic;
+			loan.Paid++;
+			if(loan.Paid >= LoanMaturity){return 1;}
+		}
+
+		else
+		{
+			loan.Missed++;
+			block.Missed++;
+			if((loan.Missed >= LimitToDefault) and (loan.LongTerm == 0))
+			{
+				double NPL = loan.Capital;
+				Loans.NPL[a]+=NPL;
+				block.BankNPL.push_back(make_pair(Accounts.Bank[a], NPL/loan.Capital));
+				loan.State = 2;
+				PROFILE_EVENT(EventLoanDefaults);
+			}
+		}
+	}
+	if((loan.State == 0) and (loan.LongTerm == 0))
+	{
+		block.GLoan+=loan.Capital;
+	}
+
+	else if ((loan.State == 2) and (loan.LongTerm == 0))
+	{
+		block.GNPL+=loan.Capital;
+	}
+	return 0;
+}
+
+void Simulation::FirmBS_Update(int i, FinanceBlock& block)
+{
+	PROFILE_CALL(PhaseBalanceSheet);
+	double paid_capital = 0;
+	double total_amortization = 0;
+	double profit = Firm.rzDemand[i] - Firm.Expenses[i];
+	int banks = Accounts.Start[i+1] - Accounts.Start[i];
+
+	/*The loans requested by the firm in this period are the last ones of the requests of the block*/
+	size_t r = block.Requests.size();
+	while ((r > 0) and (block.Requests[r-1].Account >= Accounts.Start[i])){r--;}
+
+	for(int a = Accounts.Start[i]; a < Accounts.Start[i+1]; a++)
+    {
+		if (Loans.Opened[a] == 0){continue;}
+		double* account = Loans.Account(a);
+		/*
+		 * Update of the deposit in each bank account based on the profit only (not final update)
+		*/
+		account[1]=Firm.Deposit[i]/banks;
+
+		int l = Loans.Head[a];
+    	while(l != -1)
+    	{
+    		int next = Loans.Pool[l].Next;
+    		if (Service_Loan(Loans.Pool[l], a, account, paid_capital, total_amortization, block))
+    		{
+    			/*
+    			 * The loan is totally paid: its record goes back to the pool
+    			*/
+    			Loans.Unlink(a, l);
+    			block.Repaid.push_back(l);
+    		}
+    		l = next;
+    	}
+
+		/*The new loan comes after the current loans of the account*/
+		if ((r < block.Requests.size()) and (block.Requests[r].Account == a))
+		{
+			NewLoan& request = block.Requests[r];
+			request.Repaid = Service_Loan(request.Loan, a, account, paid_capital, total_amortization, block);
+			r++;
+		}
     }
+	/*
+	 * Final update of the balance sheet
+	 * Deposit / Loans / Equity
+	*/
+
+	Firm.Deposit[i]-= total_amortization;
+	Firm.Loan[i]-= paid_capital;
+	Firm.Equity[i]= Firm.Deposit[i]+Profile.OA[i] - Firm.Loan[i] - Profile.OL[i];
+	block.GDeposit+=Firm.rzDemand[i]*Profile.ProfitToSales[i] - total_amortization;
+	block.GEquity+=Firm.Equity[i];
+}
+
+void Simulation::Return_Goods()
+{
+	/*
+	 * The goods returned by the customers who cannot pay are removed from the realized demand and the deposit of their suppliers.
+	 * Each supplier gathers its returns through its out links, in the order of the customers.
+	*/
+	int N = FirmIDs.size();
+	#pragma omp parallel for schedule(dynamic, 256)
+	for (int s = 0; s < N; s++)
+	{
+		if (Profile.Active[s] == 0){continue;}
+		for (int e = OutLinks.Start[s]; e < OutLinks.Start[s+1]; e++)
+		{
+			double returned = rReturnedV[OutLinks.Twin[e]];
+			if (returned != 0.0)
+			{
+				Firm.rzDemand[s]-= returned;
+				Firm.Deposit[s]-= Profile.ProfitToSales[s]*returned;
+			}
+		}
+	}
+}
+
+void Simulation::OneStepSimulation()
+{
+	/*
+	 * This function calls all the previous functions.
+	 * It represents a simulation across all firms in one step: from t to t+1
+	*/
+	ValueGDP = 0;
+	Frontier.Full = Frontier.Full or (ActiveSetStepping == 0) or (t <= 1); //At t = 1 the disaster changes the production and the trading of all firms
+	{
+		PROFILE_SCOPE(PhaseDesiredGoods);
+		Desired_Goods();
+	}
+	int N = FirmIDs.size();
+	{
+		PROFILE_SCOPE(PhaseProductionLoop);
+		#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < N; i++)
+		{
+			if (Profile.Active[i])
+			{
+				if (Frontier.Full or Firm.Damaged[i] or Frontier.DemandChanged[i] or Frontier.ProductionInput[i])
+				{
+					double production = Firm.Pact[i];
+					ProductionInoue18(i);
+					Frontier.ProductionChanged[i] = Frontier.Full or (Same(production, Firm.Pact[i]) == 0);
+				}
+				else {Frontier.ProductionChanged[i] = 0;}
+
+				if (Frontier.ProductionChanged[i] or Frontier.DemandChanged[i]){Trading(i);}
+				else {Replay_Trading(i);}
+			}
+		}
+	}
+	{
+		PROFILE_SCOPE(PhaseReceiveGoods);
+		Receive_Goods();
+	}
+
+	/*
+	 * Financial phase: loans, payments and balance sheets, in parallel over blocks of firms
+	*/
+	int blocks = (N + FirmBlock - 1)/FirmBlock;
+	Finance.resize(blocks);
+	for (int b = 0; b < blocks; b++)
+	{
+		FinanceBlock& block = Finance[b];
+		block.GLoan = 0;
+		block.GNPL = 0;
+		block.GDeposit = 0;
+		block.GEquity = 0;
+		block.GvtSupport = 0;
+		block.Missed = 0;
+		block.Requests.clear();
+		block.Repaid.clear();
+		block.BankNPL.clear();
+	}
+
+	{
+		PROFILE_SCOPE(PhaseFinanceLoop);
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int b = 0; b < blocks; b++)
+		{
+			for (int i = b*FirmBlock; i < std::min(N, (b+1)*FirmBlock); i++)
+			{
+				if (Profile.Active[i])
+				{
+					if(ShortLoans==1){NeedLoan(i, Finance[b]);}
+					if(WithPayment==1){Payment(i);}
+					FirmBS_Update(i, Finance[b]);
+				}
+			}
+		}
+	}
+	{
+		PROFILE_SCOPE(PhaseOpenLoans);
+		Open_Loans();
+	}
+	{
+		PROFILE_SCOPE(PhaseReturnGoods);
+		Return_Goods();
+	}
+
+	{
+		PROFILE_SCOPE(PhaseLoanCleanup);
+		for (int b = 0; b < blocks; b++)
+		{
+			FinanceBlock& block = Finance[b];
+			GLoan+=block.GLoan;
+			GNPL+=block.GNPL;
+			GDeposit+=block.GDeposit;
+			GEquity+=block.GEquity;
+			GvtSupport+=block.GvtSupport;
+			for (size_t r = 0; r < block.Repaid.size(); r++){Loans.Release(block.Repaid[r]);}
+			for (size_t r = 0; r < block.BankNPL.size(); r++)
+			{
+				BankNPLH[block.BankNPL[r].first][0] += block.BankNPL[r].second;
+				BankNPLH[block.BankNPL[r].first][1]++;
+			}
+		}
+	}
+
+	double min = 0.0;
+	double max = 0.0;
+	for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+	{
+		double recover = Firm.Deposit[*it]/(Profile.Pini[*it]*DamageMagnitude*(1-1/LTLoanMaturity));
+		if (min < recover){min = recover;}
+		if (max > recover){max = recover;}
+	}
+
+	for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+	{
+		double recover = Firm.Deposit[*it]/(Profile.Pini[*it]*DamageMagnitude*(1-1/LTLoanMaturity));
+		Firm.Recovery[*it] = Scale(min,max,recover);
+	}
+
+	{
+		PROFILE_SCOPE(PhaseInventory);
+		for (int c = 0; c < N; c++)
+		{
+			/*The changes of the inputs of the firm give the active set of the next step*/
+			Frontier.OrdersInput[c] = (Same(Frontier.LastRzDemand[c], Firm.rzDemand[c]) == 0);
+			Frontier.ProductionInput[c] = 0;
+			Frontier.LastRzDemand[c] = Firm.rzDemand[c];
+			if (InLinks.Start[c+1] == InLinks.Start[c]){continue;}
+			Firm.fUsedInventory[c] = 0;
+	        for (int e = InLinks.Start[c]; e < InLinks.Start[c+1]; e++)
+	        {
+	        	/*
+	        	 * Update the inventory at the firm level.
+	        	 * Update the inventory at the sector level.
+	        	*/
+
+	        	double used = InLinks.Weight[e]*Firm.Pact[c]/Profile.Pini[c];
+	        	double inventory = fInventoryV[e]-used + AccfInventoryV[e];
+	        	if (Same(fInventoryV[e], inventory) == 0){Frontier.OrdersInput[c] = 1;}
+	        	fInventoryV[e]=inventory;
+	        	int k = Sectors.Slot[e];
+	        	double stock = Stock.Inventory[k]-used + Stock.AccInventory[k];
+	        	if (Same(Stock.Inventory[k], stock) == 0){Frontier.ProductionInput[c] = 1;}
+	        	Stock.Inventory[k]=stock;
+	        	Firm.fUsedInventory[c]+=used;
+	        	AccfInventoryV[e] = 0;
+	        	Stock.AccInventory[k] = 0;
+	        }
+		}
+	}
+	Frontier.Full = 0;
+
+	for (int i = 0; i < N; i++)
+	{
+		if (Profile.Active[i] == 0){continue;}
+		double val = Firm.rzDemand[i] - Firm.fUsedInventory[i];
+		if (ValueAddedHistory != 0){ValueAdded.Current[i] = val;}
+		ValueGDP+=val;
+	}
+	Record_ValueAdded(t);
+	RateNPLH.push_back(GNPL/(GLoan+GNPL));
+	GDP.push_back(ValueGDP);
+	NPLH.push_back(GNPL);
+	DepositH.push_back(GDeposit);
+	GDeposit = 0;
+	LoanH.push_back(GLoan);
+	GLoan = 0;
+	GNPL = 0;
+	EquityH.push_back(GEquity);
+	GEquity = 0;
+
+}
+
+void Simulation::Simulate()
+{
+	/*
+	 * This function is the whole system simulation.
+	 * It calls only the procedure OneStepSimulation() over the simulation time.
+	*/
+
+	while(t < SimTime)
+	{
+		Step();
+		if ((EquilibriumTolerance > 0) and (t < SimTime))
+		{
+			StationaryDays = Stationary_Step() ? StationaryDays + 1 : 0;
+			if (StationaryDays >= EquilibriumWindow)
+			{
+				{
+					lock_guard<mutex> lock(ConsoleMutex);
+					cout << "equilibrium ; " << Replication << " ; " << t << endl;
+				}
+				Fill_Equilibrium();
+				if (CheckpointEvery > 0){Write_Checkpoint();}
+			}
+		}
+	}
+	Write_Panel();
+}
+
+/*This procedure simulates the step t and moves to the next step*/
+void Simulation::Step()
+{
+#if SNSE_PROFILE
+	if ((int)Timing.size() < ProfileThreads()){Timing.resize(ProfileThreads());}
+#endif
+	PROFILE_SCOPE(PhaseStep);
+	if(t==1)
+	{
+		DamagedFirms();
+		disaster = 1;
+		if(LTLoansModel==1)
+		{
+			for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+			{
+				double TotalLoanDde = Profile.Pini[*it]*DamageMagnitude;
+
+				int banks = Accounts.Start[*it+1] - Accounts.Start[*it];
+				for(int a = Accounts.Start[*it]; a < Accounts.Start[*it+1]; a++)
+				{
+				    double ln = TotalLoanDde/banks;
+				    double rate = 0.04;
+				    double periodic = ln*rate/(1-pow(1+rate,-LTLoanMaturity));
+
+				    Loans.Add(a, ln, rate, periodic, 1); //long-term loan
+				    Loans.Account(a)[0]+=ln;
+				    PROFILE_EVENT(EventLoansIssued);
+
+				}
+			}
+		}
+	}
+	OneStepSimulation();
+	if (StepLog)
+	{
+		lock_guard<mutex> lock(ConsoleMutex);
+		cout << "step ; " << t << " ; " << GDP[GDP.size()-1] << '\n';
+	}
+	++t;
+	if ((CheckpointEvery > 0) and ((t % CheckpointEvery == 0) or (t == SimTime))){Write_Checkpoint();}
+}
+
+/*
+ * Equilibrium
+ * After the recovery, the economy can become stationary: the damage of each firm is within the tolerance, the residual of the production of each firm against its initial production doesn't move,
+ * no loan is given, missed or in default, no support is paid and the GDP doesn't move.
+ * The residuals and the GDP are compared with their values at the start of the window, not at the previous step, so a slow trend is not taken for an equilibrium.
+ * When the steps satisfy these conditions for EquilibriumWindow consecutive steps, the remaining days are not simulated:
+ * the GDP and the value added keep their last values, and the loans are paid on their schedule until SimTime.
+*/
+
+/*This function tells if the last step satisfies the conditions of the equilibrium*/
+bool Simulation::Stationary_Step()
+{
+	/*
+	 * The window starts at the last step which did not satisfy the conditions: the residuals of that step are kept in Residual,
+	 * and its GDP is StationaryDays steps before the previous one. A step which leaves the window starts a new one.
+	*/
+	int N = FirmIDs.size();
+	bool stationary = (t > StartRecover) and (GDP.size() >= 2 + (size_t)StationaryDays) and (NPLH.back() == 0.0);
+	if (stationary){stationary = (std::fabs(GDP[GDP.size()-1] - GDP[GDP.size()-2-StationaryDays]) <= EquilibriumTolerance*std::fabs(GDP[0]));}
+	for (size_t b = 0; (b < Finance.size()) and stationary; b++)
+	{
+		if ((Finance[b].Requests.empty() == 0) or (Finance[b].GvtSupport != 0.0) or (Finance[b].Missed != 0)){stationary = 0;}
+	}
+	for (int i = 0; (i < N) and stationary; i++)
+	{
+		if (Profile.Active[i] == 0){continue;}
+		double residual = (Firm.Pact[i] - Profile.Pini[i])/Profile.Pini[i];
+		if ((std::fabs(residual - Residual[i]) > EquilibriumTolerance) or std::isnan(residual)){stationary = 0;}
+		if (Firm.Delta[i] > EquilibriumTolerance){stationary = 0;} //The capacity of a damaged firm still grows
+	}
+	if (stationary == 0)
+	{
+		for (int i = 0; i < N; i++)
+		{
+			if (Profile.Active[i] == 0){continue;}
+			Residual[i] = (Firm.Pact[i] - Profile.Pini[i])/Profile.Pini[i];
+		}
+	}
+	return stationary;
+}
+
+/*
+ * This procedure fills the days from t to SimTime of a stationary economy.
+ * Each loan is paid at each step until its maturity: the loans, the amortization and the paid capital of each day are counted by difference over the days.
+ * The deposits grow with the profit of the constant sales and fall with the amortization; the loan book and the balance sheets are left as at SimTime.
+*/
+void Simulation::Fill_Equilibrium()
+{
+	int days = SimTime - t;
+	if (days <= 0){return;}
+	int N = FirmIDs.size();
+
+	/*Change at day k (1..days) of the loans, the amortization and the paid capital*/
+	vector<double> loans(days + 2, 0.0), amortization(days + 2, 0.0), capital(days + 2, 0.0);
+	vector<double> account_last(Accounts.Bank.size(), 0.0); //Amortization of each account at the last day
+	double sales = 0; //Profit of the sales of a day
+	for (int i = 0; i < N; i++)
+	{
+		if (Profile.Active[i] == 0){continue;}
+		sales+=Firm.rzDemand[i]*Profile.ProfitToSales[i];
+		int banks = Accounts.Start[i+1] - Accounts.Start[i];
+		double firm_amortization = 0;
+		double firm_capital = 0;
+		double last_amortization = 0; //Amortization of the firm at the last day
+		for (int a = Accounts.Start[i]; a < Accounts.Start[i+1]; a++)
+		{
+			for (int l = Loans.Head[a]; l != -1;)
+			{
+				LoanRecord& loan = Loans.Pool[l];
+				int next = loan.Next;
+				int payments = std::min(days, std::max(0, LoanMaturity - loan.Paid)); //The loan is paid at the days 1..payments
+				double paid = loan.Capital/LoanMaturity;
+				amortization[1]+=loan.Periodic;
+				amortization[payments + 1]-=loan.Periodic;
+				capital[1]+=paid;
+				capital[payments + 1]-=paid;
+				if (loan.LongTerm == 0)
+				{
+					/*A short-term loan is counted in the loans of the day if it is not totally paid at this day*/
+					int counted = std::min(days, std::max(0, LoanMaturity - loan.Paid - 1));
+					loans[1]+=loan.Capital;
+					loans[counted + 1]-=loan.Capital;
+				}
+				firm_amortization+=payments*loan.Periodic;
+				firm_capital+=payments*paid;
+				Loans.Account(a)[0]-=payments*paid;
+				if (payments == days){account_last[a]+=loan.Periodic;}
+				if (loan.Paid + payments >= LoanMaturity){Loans.Remove(a, l);}
+				else {loan.Paid+=payments;}
+				l = next;
+			}
+			last_amortization+=account_last[a];
+		}
+
+		/*Balance sheet at SimTime; the deposit of each account is the share of the deposit of the firm before the last amortization*/
+		Firm.Deposit[i]+=days*Profile.ProfitToSales[i]*Firm.rzDemand[i] - firm_amortization;
+		Firm.Loan[i]-=firm_capital;
+		Firm.Equity[i] = Firm.Deposit[i]+Profile.OA[i] - Firm.Loan[i] - Profile.OL[i];
+		for (int a = Accounts.Start[i]; a < Accounts.Start[i+1]; a++)
+		{
+			if (Loans.Opened[a]){Loans.Account(a)[1] = (Firm.Deposit[i] + last_amortization)/banks - account_last[a];}
+		}
+	}
+
+	double gdp = GDP.back();
+	double equity = EquityH.back();
+	double loan = 0, amortized = 0, paid = 0;
+	for (int k = 1; k <= days; k++)
+	{
+		loan+=loans[k];
+		amortized+=amortization[k];
+		paid+=capital[k];
+		equity+=sales - amortized + paid;
+		GDP.push_back(gdp);
+		NPLH.push_back(0.0);
+		LoanH.push_back(loan);
+		RateNPLH.push_back(0.0/(loan + 0.0));
+		DepositH.push_back(sales - amortized);
+		EquityH.push_back(equity);
+	}
+	for (int day = t; day < SimTime; day++){Record_ValueAdded(day);} //The value added of the firms keeps its last value
+	t = SimTime;
+}
+
+/*
+ * Panel of the value added
+ * The panel of a replication has a header, the IDs of the N firms (int64), then one row per kept day in the order of the days: the day (int64) and the N values (double).
+ * With 1 and 2 the rows are kept in memory and the panel is written at the end of the replication; with 3 each kept day is written at once and only the last row is in memory.
+*/
+
+const char PanelMagic[8] = {'S', 'N', 'S', 'E', 'V', 'A', 'P', '\0'};
+const uint32_t PanelVersion = 1;
+
+struct PanelHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t Endian;
+	uint64_t Seed;
+	int64_t Replication;
+	int64_t Firms;
+	int64_t History; //ValueAddedHistory
+	int64_t Stride; //ValueAddedStride, or ValueAddedWindow for the ring
+};
+
+/*This procedure keeps the value added of the firms at the day, if the day is kept*/
+void Simulation::Record_ValueAdded(int day)
+{
+	if (ValueAddedHistory == 0){return;}
+	if ((ValueAddedHistory != 2) and (day % std::max(1, ValueAddedStride) != 0)){return;}
+	int N = ValueAdded.Current.size();
+	if (ValueAddedHistory == 3)
+	{
+		if (!ValueAdded.File){Open_Panel();}
+		int64_t row_day = day;
+		ValueAdded.File->write(reinterpret_cast<const char*>(&row_day), sizeof(row_day));
+		ValueAdded.File->write(reinterpret_cast<const char*>(ValueAdded.Current.data()), N*sizeof(double));
+		if (!*ValueAdded.File){throw runtime_error(ValueAddedPrefix + to_string(Replication) + ".bin: cannot write the panel");}
+		ValueAdded.Written++;
+		return;
+	}
+
+	int window = std::max(1, ValueAddedWindow);
+	if (ValueAdded.Days.empty())
+	{
+		size_t rows = (ValueAddedHistory == 2) ? window : SimTime/std::max(1, ValueAddedStride) + 1;
+		ValueAdded.Values.reserve(rows*N);
+		ValueAdded.Days.reserve(rows);
+	}
+	if ((ValueAddedHistory == 1) or ((int)ValueAdded.Days.size() < window))
+	{
+		ValueAdded.Values.insert(ValueAdded.Values.end(), ValueAdded.Current.begin(), ValueAdded.Current.end());
+		ValueAdded.Days.push_back(day);
+	}
+	else
+	{
+		std::copy(ValueAdded.Current.begin(), ValueAdded.Current.end(), ValueAdded.Values.begin() + (size_t)ValueAdded.Next*N);
+		ValueAdded.Days[ValueAdded.Next] = day;
+	}
+	if (ValueAddedHistory == 2){ValueAdded.Next = (ValueAdded.Next + 1) % window;}
+}
+
+/*This procedure opens the panel of the replication: a new panel gets its header, a panel resumed from a checkpoint continues after its written rows*/
+void Simulation::Open_Panel()
+{
+	std::string path = ValueAddedPrefix + to_string(Replication) + ".bin";
+	int N = FirmIDs.size();
+	size_t start = sizeof(PanelHeader) + N*sizeof(int64_t);
+	if (ValueAdded.Written == 0)
+	{
+		ValueAdded.File = std::make_shared<fstream>(path, ios::out | ios::binary | ios::trunc);
+		if (!*ValueAdded.File){throw runtime_error(path + ": cannot write the panel");}
+		PanelHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.Magic, PanelMagic, 8);
+		header.Version = PanelVersion;
+		header.Endian = 0x01020304;
+		header.Seed = Seed;
+		header.Replication = Replication;
+		header.Firms = N;
+		header.History = ValueAddedHistory;
+		header.Stride = (ValueAddedHistory == 2) ? ValueAddedWindow : ValueAddedStride;
+		ValueAdded.File->write(reinterpret_cast<const char*>(&header), sizeof(header));
+		vector<int64_t> ids(FirmIDs.begin(), FirmIDs.end());
+		ValueAdded.File->write(reinterpret_cast<const char*>(ids.data()), N*sizeof(int64_t));
+	}
+	else
+	{
+		ValueAdded.File = std::make_shared<fstream>(path, ios::in | ios::out | ios::binary);
+		if (!*ValueAdded.File){throw runtime_error(path + ": the panel of the checkpoint is missing");}
+		ValueAdded.File->seekp(start + ValueAdded.Written*(sizeof(int64_t) + N*sizeof(double)));
+	}
+	if (!*ValueAdded.File){throw runtime_error(path + ": cannot write the panel");}
+}
+
+/*This procedure ends the panel of the replication: the rows kept in memory are written in the order of the days*/
+void Simulation::Write_Panel()
+{
+	if ((ValueAddedHistory == 1) or (ValueAddedHistory == 2))
+	{
+		ValueAdded.Written = 0;
+		Open_Panel();
+		int N = ValueAdded.Current.size();
+		int rows = ValueAdded.Days.size();
+		int first = (ValueAddedHistory == 2) ? ValueAdded.Next % std::max(1, rows) : 0; //The oldest row of the ring
+		for (int k = 0; k < rows; k++)
+		{
+			int r = (first + k) % rows;
+			int64_t row_day = ValueAdded.Days[r];
+			ValueAdded.File->write(reinterpret_cast<const char*>(&row_day), sizeof(row_day));
+			ValueAdded.File->write(reinterpret_cast<const char*>(&ValueAdded.Values[(size_t)r*N]), N*sizeof(double));
+		}
+		ValueAdded.Written = rows;
+	}
+	if (ValueAdded.File)
+	{
+		ValueAdded.File->close();
+		if (!*ValueAdded.File){throw runtime_error(ValueAddedPrefix + to_string(Replication) + ".bin: cannot write the panel");}
+		ValueAdded.File.reset();
+	}
+}
+
+/*This procedure adds the accounts of the firms bank by bank at the end of the simulation*/
+void Simulation::Bank_Balances()
+{
+	for (size_t a = 0; a < Accounts.Bank.size(); a++)
+	{
+		BankLoanDepositH[Accounts.Bank[a]][0]+=Loans.Account(a)[0];
+		BankLoanDepositH[Accounts.Bank[a]][1]+=Loans.Account(a)[1];
+	}
+}
+
+/*This function hands the saved series over to the driver; the replication is not used afterwards*/
+SimulationResults Simulation::Results()
+{
+	SimulationResults results;
+	results.GDP.swap(GDP);
+	results.NPLH.swap(NPLH);
+	results.DepositH.swap(DepositH);
+	results.LoanH.swap(LoanH);
+	results.EquityH.swap(EquityH);
+	results.RateNPLH.swap(RateNPLH);
+	for (set <int>::iterator itr = DamagedFirmsH.begin(); itr != DamagedFirmsH.end(); ++itr)
+	{
+		results.DamagedFirms.push_back(FirmIDs[*itr]);
+	}
+	results.GvtSupport = GvtSupport;
+	for (size_t k = 0; k < Timing.size(); k++){results.Timing.Add(Timing[k]);}
+	results.Trace.swap(Trace);
+	return results;
+}
+
+/*
+ * Checkpoints
+ * A checkpoint holds the whole state of a replication at the end of a step: the firms, the inventories, the loan book, the bank aggregates, the saved series and the position of the random streams.
+ * The parameters and the network are not saved: they are those of the snapshot, and the header checks that the network has the same size.
+ * A replication resumed from a checkpoint continues exactly as the uninterrupted replication.
+*/
+
+const char CheckpointMagic[8] = {'S', 'N', 'S', 'E', 'C', 'K', 'P', 'T'};
+const uint32_t CheckpointVersion = 4;
+
+struct CheckpointHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t Endian;
+	uint64_t Seed;
+	int64_t Replication;
+	int64_t Firms;
+	int64_t Links;
+	int64_t Accounts;
+	int64_t Step;
+	uint64_t PayloadSize;
+	uint64_t Checksum;
+};
+
+/*This function reads the header of a checkpoint; it returns 0 if the file is missing or is not a checkpoint*/
+bool ReadCheckpointHeader(const std::string& path, CheckpointHeader& header)
+{
+	MappedFile file(path);
+	if ((size_t)(file.End - file.Begin) < sizeof(CheckpointHeader)){return 0;}
+	memcpy(&header, file.Begin, sizeof(header));
+	return (memcmp(header.Magic, CheckpointMagic, 8) == 0) and (header.Version == CheckpointVersion) and (header.Endian == 0x01020304);
 }
 
-void DamagedFirms()
+std::string CheckpointPath(int replication)
 {
-	/*
-	 * Random selection of X% of firms as damaged
-	 * Damaged firms are saved in the set DamagedFirmsH
-	*/
-	int total_size = Firms.size();
-	double min = 0.0;
-	double max = 0.0;
+	return CheckpointPrefix + to_string(replication) + ".bin";
+}
 
-	while(DamagedFirmsH.size() < NumberDamagedFirms*total_size)
+/*The state of the replication, in the order of the checkpoint*/
+template <typename Archive> void Simulation::State(Archive& archive)
+{
+	archive.Scalar(t);
+	archive.Scalar(disaster);
+	archive.Scalar(StationaryDays);
+	archive(Residual);
+	archive.Scalar(DamageRandom.Key);
+	archive.Scalar(DamageRandom.Counter);
+
+	for (Column<double>* column : {&Firm.Pact, &Firm.dOrders, &Firm.GROrders, &Firm.rcDemand, &Firm.rzDemand, &Firm.fUsedInventory, &Firm.Delta, &Firm.Recovery,
+			&Firm.LTLoans, &Firm.Deposit, &Firm.Loan, &Firm.Equity, &Firm.Expenses})
+	{
+		archive(*column);
+	}
+	for (Column<int>* column : {&Firm.Days, &Firm.LoanFlag, &Firm.NoLoans})
+	{
+		archive(*column);
+	}
+	archive(Firm.Damaged);
+
+	/*The kept value added; a streamed panel continues after the rows written before the checkpoint*/
+	archive(ValueAdded.Current);
+	archive(ValueAdded.Values);
+	archive(ValueAdded.Days);
+	archive.Scalar(ValueAdded.Next);
+	archive.Scalar(ValueAdded.Written);
+	if (archive.Reading)
 	{
-		int random_damage = rand() % Firms.size();
-		auto itr_damage = std::next(std::begin(Firms), random_damage);
-		if(DisasterScenario == 0)
+		if ((ValueAdded.Current.size() != (ValueAddedHistory != 0 ? FirmIDs.size() : 0)) or (ValueAdded.Values.size() != ValueAdded.Days.size()*ValueAdded.Current.size()))
 		{
-			DamagedFirmsH.insert(*itr_damage);
-			DeltaH[*itr_damage] = DamageMagnitude;
-			Firms.erase(*itr_damage);
-			double recover = FirmBSH[*itr_damage][0]/(ProductionIniH[*itr_damage]*DamageMagnitude);
-			LTLoansH[*itr_damage] = ProductionIniH[*itr_damage]*DamageMagnitude;
-			if (min < recover){min = recover;}
-			if (max > recover){max = recover;}
+			throw runtime_error("value added of another history");
 		}
-		else if(DisasterScenario == 1)
+		ValueAdded.File.reset();
+	}
+
+	for (vector<double>* links : {&dOrdersV, &rOrdersV, &rReturnedV, &rcDemandFirmLevelV, &fInventoryV, &AccfInventoryV})
+	{
+		archive(*links);
+	}
+	archive(Stock.Inventory);
+	archive(Stock.AccInventory);
+
+	vector<int> damaged(DamagedFirmsH.begin(), DamagedFirmsH.end());
+	archive(damaged);
+	if (archive.Reading){DamagedFirmsH = set<int>(damaged.begin(), damaged.end());}
+
+	for (vector<double>* series : {&GDP, &NPLH, &DepositH, &LoanH, &EquityH, &RateNPLH})
+	{
+		archive(*series);
+	}
+	for (double* value : {&ValueGDP, &GNPL, &GDeposit, &GLoan, &GEquity, &GvtSupport, &RateNPL, &CountNPL})
+	{
+		archive.Scalar(*value);
+	}
+
+	archive(Loans.Pool);
+	archive.Scalar(Loans.FreeHead);
+	archive(Loans.Head);
+	archive(Loans.Tail);
+	archive(Loans.Opened);
+	archive(Loans.Balance);
+	archive(Loans.PayByLoan);
+	archive(Loans.NPL);
+
+	/*The bank aggregates, bank by bank in the order of the IDs*/
+	vector<int> banks, sizes;
+	vector<double> npl;
+	vector<int> balances;
+	if (archive.Reading == 0)
+	{
+		for (unordered_map<int, vector<double> >::iterator itr = BankNPLH.begin(); itr != BankNPLH.end(); ++itr){banks.push_back(itr->first);}
+		std::sort(banks.begin(), banks.end());
+		for (size_t b = 0; b < banks.size(); b++)
 		{
-			if(GeographicLocationH[*itr_damage] == location_of_disaster)
-			{
-				DamagedFirmsH.insert(*itr_damage);
-				DeltaH[*itr_damage] = DamageMagnitude;
-				Firms.erase(*itr_damage);
-				double recover = FirmBSH[*itr_damage][0]/(ProductionIniH[*itr_damage]*DamageMagnitude);
-				LTLoansH[*itr_damage] = ProductionIniH[*itr_damage]*DamageMagnitude;
-				if (min < recover){min = recover;}
-				if (max > recover){max = recover;}
-			}
+			vector<double>& bank = BankNPLH[banks[b]];
+			sizes.push_back(bank.size());
+			npl.insert(npl.end(), bank.begin(), bank.end());
+		}
+	}
+	archive(banks);
+	archive(sizes);
+	archive(npl);
+	if (archive.Reading)
+	{
+		if (sizes.size() != banks.size()){throw runtime_error("truncated");}
+		BankNPLH.clear();
+		size_t position = 0;
+		for (size_t b = 0; b < banks.size(); b++)
+		{
+			if ((sizes[b] < 0) or (npl.size() - position < (size_t)sizes[b])){throw runtime_error("truncated");}
+			BankNPLH[banks[b]].assign(npl.begin() + position, npl.begin() + position + sizes[b]);
+			position += sizes[b];
 		}
+	}
 
-		else if (DisasterScenario == 2)
+	banks.clear();
+	sizes.clear();
+	if (archive.Reading == 0)
+	{
+		for (unordered_map<int, vector<int> >::iterator itr = BankLoanDepositH.begin(); itr != BankLoanDepositH.end(); ++itr){banks.push_back(itr->first);}
+		std::sort(banks.begin(), banks.end());
+		for (size_t b = 0; b < banks.size(); b++)
 		{
-			if(SectorH[*itr_damage] == sector_of_disaster)
-			{
-				DamagedFirmsH.insert(*itr_damage);
-				DeltaH[*itr_damage] = DamageMagnitude;
-				Firms.erase(*itr_damage);
-				double recover = FirmBSH[*itr_damage][0]/(ProductionIniH[*itr_damage]*DamageMagnitude);
-				LTLoansH[*itr_damage] = ProductionIniH[*itr_damage]*DamageMagnitude;
-				if (min < recover){min = recover;}
-				if (max > recover){max = recover;}
-			}
+			vector<int>& bank = BankLoanDepositH[banks[b]];
+			sizes.push_back(bank.size());
+			balances.insert(balances.end(), bank.begin(), bank.end());
 		}
 	}
-	for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+	archive(banks);
+	archive(sizes);
+	archive(balances);
+	if (archive.Reading)
 	{
-		double recover = FirmBSH[*it][0]/(ProductionIniH[*it]*DamageMagnitude);
-		RecoveryH[*it] = Scale(min,max,recover);
+		if (sizes.size() != banks.size()){throw runtime_error("truncated");}
+		BankLoanDepositH.clear();
+		size_t position = 0;
+		for (size_t b = 0; b < banks.size(); b++)
+		{
+			if ((sizes[b] < 0) or (balances.size() - position < (size_t)sizes[b])){throw runtime_error("truncated");}
+			BankLoanDepositH[banks[b]].assign(balances.begin() + position, balances.begin() + position + sizes[b]);
+			position += sizes[b];
+		}
 	}
 }
 
+/*This procedure writes the checkpoint of the replication; as the network cache, it is written under a temporary name and renamed once complete*/
+void Simulation::Write_Checkpoint()
+{
+	std::string path = CheckpointPath(Replication);
+	if (ValueAdded.File){ValueAdded.File->flush();} //The streamed rows counted in the checkpoint are in the panel
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, CheckpointMagic, 8);
+	header.Version = CheckpointVersion;
+	header.Endian = 0x01020304;
+	header.Seed = Seed;
+	header.Replication = Replication;
+	header.Firms = FirmIDs.size();
+	header.Links = InLinks.Firm.size();
+	header.Accounts = Accounts.Bank.size();
+	header.Step = t;
+
+	std::string temporary = path + ".tmp";
+	ofstream file(temporary, ios::binary);
+	if (!file){throw runtime_error(path + ": cannot write the checkpoint");}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	BinaryWriter writer(file);
+	State(writer);
+	header.PayloadSize = writer.Size;
+	header.Checksum = writer.Checksum;
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.close();
+	if (!file){throw runtime_error(path + ": cannot write the checkpoint");}
+	std::remove(path.c_str());
+	if (std::rename(temporary.c_str(), path.c_str()) != 0){throw runtime_error(path + ": cannot write the checkpoint");}
+}
 
-void ProductionInoue18(int ID)
+/*
+ * This function restores the replication from its checkpoint; it returns 0 if there is no checkpoint of this seed and network, and the replication then starts at t = 0.
+ * A checkpoint which matches but is corrupted is an error: restarting silently would lose the simulated steps.
+*/
+bool Simulation::Read_Checkpoint()
 {
-	/*
-	 * The production function for one firm ID
-	 * This production function is a reproduction of Inoue and Todo (2018)
-	*/
-    double Pcap;
-    vector<double> Pproi;
-    double minPproi;
-    double Pmax;
+	std::string path = CheckpointPath(Replication);
+	CheckpointHeader header;
+	if (ReadCheckpointHeader(path, header) == 0){return 0;}
+	if ((header.Seed != Seed) or (header.Replication != Replication) or (header.Firms != (int64_t)FirmIDs.size()) or (header.Links != (int64_t)InLinks.Firm.size())
+			or (header.Accounts != (int64_t)Accounts.Bank.size()))
+	{
+		return 0;
+	}
 
-    /* Calculate the capacity of production after disaster Equation (4) */
-	if ((DamagedFirmsH.find(ID) != DamagedFirmsH.end())==1)
+	MappedFile file(path);
+	const char* payload = file.Begin + sizeof(header);
+	if (((size_t)(file.End - file.Begin) < sizeof(header)) or ((uint64_t)(file.End - payload) != header.PayloadSize)
+			or (BinaryChecksum(0xCBF29CE484222325ULL, payload, header.PayloadSize) != header.Checksum))
+	{
+		throw runtime_error(path + ": corrupted checkpoint");
+	}
+	BinaryReader reader;
+	reader.Position = payload;
+	reader.End = file.End;
+	try
+	{
+		State(reader);
+	}
+	catch (const runtime_error& error)
+	{
+		throw runtime_error(path + ": " + error.what());
+	}
+	Frontier.Full = 1; //The active set is not saved
+	if ((t != header.Step) or (Firm.Pact.size() != FirmIDs.size()) or (fInventoryV.size() != InLinks.Firm.size()) or (Loans.Head.size() != Accounts.Bank.size()))
+	{
+		throw runtime_error(path + ": checkpoint of another network");
+	}
+	return 1;
+}
+
+/*
+ * Statistics across replications
+ * The statistics of each day are updated with each replication, so they don't depend on the number of replications kept in memory:
+ * mean and variance (Welford), minimum, maximum, and quantiles.
+ * The quantiles are exact for the first ExactQuantiles replications; beyond, they are estimated by the P2 algorithm (Jain and Chlamtac, 1985) with five markers per quantile, set from the kept values.
+ * The values which are not finite (e.g. the NPL rate without loans) are not counted.
+*/
+
+const int BandCount = 5;
+const double BandQuantiles[BandCount] = {0.05, 0.25, 0.5, 0.75, 0.95}; //Quantiles of the fan charts
+const int ExactQuantiles = 64;
+
+struct P2Quantile
+{
+	double P;
+	double Height[5];
+	double Position[5];
+	double Desired[5];
+	double Increment[5];
+
+	P2Quantile(double p = 0.5) : P(p) {}
+
+	/*The markers are set from the n first values, sorted*/
+	void Start(const double* sorted, int n)
 	{
-		if (t < StartRecover){Pcap = (1-DeltaH[ID])*ProductionIniH[ID];}
+		double fraction[5] = {0, P/2, P, (1 + P)/2, 1};
+		for (int m = 0; m < 5; m++)
+		{
+			Desired[m] = 1 + (n - 1)*fraction[m];
+			Increment[m] = fraction[m];
+			Position[m] = std::floor(Desired[m] + 0.5);
+			if (m > 0){Position[m] = std::max(Position[m], Position[m-1] + 1);}
+		}
+		for (int m = 3; m >= 0; m--){Position[m] = std::min(Position[m], Position[m+1] - 1);}
+		for (int m = 0; m < 5; m++){Height[m] = sorted[(int)Position[m] - 1];}
+	}
+
+	void Add(double x)
+	{
+		/*The cell of x; the extreme markers follow the minimum and the maximum*/
+		int k;
+		if (x < Height[0]){Height[0] = x; k = 0;}
+		else if (x >= Height[4]){Height[4] = x; k = 3;}
 		else
 		{
-			if (DeltaH[ID]!=0.0){DeltaH[ID] = (1-RecoveryH[ID])*DeltaH[ID];}
-			Pcap = (1-DeltaH[ID])*ProductionIniH[ID];
+			k = 0;
+			while (x >= Height[k+1]){k++;}
+		}
+		for (int m = k + 1; m < 5; m++){Position[m]++;}
+		for (int m = 0; m < 5; m++){Desired[m] += Increment[m];}
+
+		/*The middle markers move toward their desired positions by one step*/
+		for (int m = 1; m < 4; m++)
+		{
+			double d = Desired[m] - Position[m];
+			if (((d >= 1) and (Position[m+1] - Position[m] > 1)) or ((d <= -1) and (Position[m-1] - Position[m] < -1)))
+			{
+				int s = (d >= 0) ? 1 : -1;
+				double q = Height[m] + s/(Position[m+1] - Position[m-1])*((Position[m] - Position[m-1] + s)*(Height[m+1] - Height[m])/(Position[m+1] - Position[m])
+						+ (Position[m+1] - Position[m] - s)*(Height[m] - Height[m-1])/(Position[m] - Position[m-1]));
+				if ((Height[m-1] < q) and (q < Height[m+1])){Height[m] = q;}
+				else {Height[m] += s*(Height[m+s] - Height[m])/(Position[m+s] - Position[m]);}
+				Position[m] += s;
+			}
 		}
 	}
-	else
+
+	double Value() const {return Height[2];}
+};
+
+struct DayStatistics
+{
+	int64_t Count = 0;
+	double Mean = 0;
+	double M2 = 0; //Sum of the squared deviations from the mean
+	double Min = numeric_limits<double>::infinity();
+	double Max = -numeric_limits<double>::infinity();
+	vector<double> First; //The first values, until the markers are set
+	P2Quantile Quantile[BandCount];
+
+	DayStatistics()
 	{
-		Pcap = ProductionIniH[ID];
+		for (int q = 0; q < BandCount; q++){Quantile[q] = P2Quantile(BandQuantiles[q]);}
 	}
 
-    /*Calculate the production under inventory constraint Equation (7)*/
-	if ((sInventoryHoH.find(ID) != sInventoryHoH.end())==0){Pproi.push_back(ProductionIniH[ID]);}
-	else
+	void Add(double x)
 	{
-		for (unordered_map<int, double>::iterator itr=sInventoryHoH[ID].begin(); itr!=sInventoryHoH[ID].end();itr++)
+		if (std::isfinite(x) == 0){return;}
+		Count++;
+		double delta = x - Mean;
+		Mean += delta/Count;
+		M2 += delta*(x - Mean);
+		Min = std::min(Min, x);
+		Max = std::max(Max, x);
+		if (Count <= ExactQuantiles)
 		{
-			Pproi.push_back(ProductionIniH[ID]*sInventoryHoH[ID][(*itr).first]/AijSectorHoH[ID][(*itr).first]);
+			First.push_back(x);
+			if (Count == ExactQuantiles)
+			{
+				std::sort(First.begin(), First.end());
+				for (int q = 0; q < BandCount; q++){Quantile[q].Start(First.data(), Count);}
+			}
+			return;
 		}
+		if (First.empty() == 0){vector<double>().swap(First);}
+		for (int q = 0; q < BandCount; q++){Quantile[q].Add(x);}
 	}
 
-	/*Calculate the real actual production of the firm equations (8 and 9)*/
-	minPproi = std::min_element(Pproi.begin(), Pproi.end())[0];
-	Pmax = std::min(Pcap,minPproi);
-	CurrentProductionH[ID]= std::min(Pmax,rcDemandVectorH[ID]);
-}
+	/*Before the markers are set, the quantile is interpolated between the sorted values*/
+	double Value(int q) const
+	{
+		if (Count == 0){return numeric_limits<double>::quiet_NaN();}
+		if (Count > ExactQuantiles){return Quantile[q].Value();}
+		vector<double> sorted(First);
+		std::sort(sorted.begin(), sorted.end());
+		double h = (Count - 1)*BandQuantiles[q];
+		int low = std::floor(h);
+		int high = std::min<int>(low + 1, Count - 1);
+		return sorted[low] + (h - low)*(sorted[high] - sorted[low]);
+	}
+};
 
-void Rationing(int ID)
+struct SeriesStatistics
 {
-	/*
-	 * 1- Each supplier ID decided about his production level.
-	 * 2- If the production is less than the received demand: Rationing policy as in Inoue and Todo (2018).
-	 * 3- Fill in these unordered maps: rOrdersHoH, rzDemandHoH, fInventoryVectorH, ValueAddedVectorH.
-	*/
-	unordered_map<int, double > RatioOrdersH; // customer; pre-to-post disaster ratio
-	unordered_map<int, double > TentativeOrdersH; // customer; new tentative orders based on the rationing policy
-	unordered_map<int, double > TentativeOrdersFirstH;
-	rzDemandVectorH[ID]=0.0; // Initialize the realized demand of the supplier
-    /*Calculate the pre-to-disaster ratio of orders of all clients of firm ID*/
-	for (unordered_map<int, double>::iterator itr=rcDemandFirmLevelH[ID].begin(); itr!=rcDemandFirmLevelH[ID].end();itr++)
+	vector<DayStatistics> Days;
+
+	void Add(const vector<double>& series)
+	{
+		if (Days.size() < series.size()){Days.resize(series.size());}
+		for (size_t i = 0; i < series.size(); i++){Days[i].Add(series[i]);}
+	}
+
+	/*One line per day: the fan chart of the series*/
+	void Write(const std::string& path) const
 	{
-		RatioOrdersH[(*itr).first] = rcDemandFirmLevelH[ID][(*itr).first]*OutPutFirmHoH[ID][(*itr).first][2];
-	    rOrdersHoH[(*itr).first][ID] = 0; /*Initialize the realized orders variable*/
-	    TentativeOrdersFirstH[(*itr).first] = RatioOrdersH[(*itr).first]*OutPutFirmHoH[ID][(*itr).first][0];
+		ostringstream lines;
+		lines << "Day\tCount\tMean\tStd\tMin";
+		for (int q = 0; q < BandCount; q++){lines << "\tQ" << BandQuantiles[q];}
+		lines << "\tMax\n";
+		for (size_t i = 0; i < Days.size(); i++)
+		{
+			const DayStatistics& day = Days[i];
+			double nan = numeric_limits<double>::quiet_NaN();
+			lines << i << '\t' << day.Count << '\t' << (day.Count > 0 ? day.Mean : nan) << '\t' << (day.Count > 1 ? sqrt(day.M2/(day.Count - 1)) : nan)
+					<< '\t' << (day.Count > 0 ? day.Min : nan);
+			for (int q = 0; q < BandCount; q++){lines << '\t' << day.Value(q);}
+			lines << '\t' << (day.Count > 0 ? day.Max : nan) << '\n';
+		}
+		ofstream file(path);
+		file << lines.str();
+		if (!file){throw runtime_error(path + ": cannot write the results");}
 	}
+};
 
-	TentativeOrdersFirstH[0] =cVectorH[ID]; //neeeeew
+/*
+ * Results writer
+ * The replications hand their results to the writer as they finish; a background thread appends them to the files, so the simulation never waits for the disk.
+ * The results are taken in the order of the replications: a replication which finishes before the previous ones waits in the queue, so the files and the statistics don't depend on the threads.
+ * Results/Series.txt: one line per replication and day: replication; day; GDP; NPL; deposit; equity; loan; NPL rate.
+ * Results/DamagedFirms.txt: one line per replication and damaged firm: replication; firm ID.
+ * Results/Series.bin: the same results in binary, replication by replication; each record is a ResultsRecord followed by the six series (Days values each, in the order of Series.txt) and the IDs of the damaged firms (int64).
+ * Results/Final*.txt: one line per replication.
+ * Results/Bands*.txt: the statistics of each series across the replications, written at the end of the run.
+ * Results/Full*.txt: one column per replication; only with RawSeries, as it keeps all series in memory until the end of the run.
+*/
+
+const char ResultsMagic[8] = {'S', 'N', 'S', 'E', 'R', 'E', 'S', '\0'};
+const uint32_t ResultsVersion = 1;
+
+struct ResultsHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t Endian;
+	uint64_t Seed;
+};
 
-	RatioOrdersH[0] = 1; //Ratio of the household consumption which is always constant.
+struct ResultsRecord
+{
+	int64_t Replication;
+	int64_t Days;
+	int64_t Damaged; //Number of damaged firms
+	double GvtSupport;
+};
 
-	std::pair<int, double> min_ratio = *min_element(RatioOrdersH.begin(), RatioOrdersH.end(), compare);
+class ResultsWriter
+{
+public:
+	ResultsWriter(uint64_t seed);
+	~ResultsWriter();
+
+	void Push(int order, int replication, SimulationResults& result);
+	void Close();
+
+private:
+	std::thread Thread;
+	mutex QueueMutex;
+	std::condition_variable Ready;
+	map<int, pair<int, SimulationResults> > Queue; //Order of the replication -> replication; results
+	int Next; //Order of the next replication to write
+	bool Closing;
+	std::exception_ptr Failure;
+
+	ofstream Text;
+	ofstream Damaged;
+	ofstream Binary;
+	ofstream FinalNPL;
+	ofstream FinalLiquidity;
+	ofstream FinalSupport;
+	ofstream TraceFile;
+
+	SeriesStatistics Bands[6]; //In the order of Series.txt
+	map<int, SimulationResults> All; //Only with RawSeries
+	ProfileCounters Timing; //Sum over the replications
+	int Replications;
+	bool TraceStarted; //At least one span is written in the trace
+
+	void Run();
+	void Append(int replication, const SimulationResults& result);
+	void WriteTrace(int replication, const vector<TraceSpan>& trace);
+	void WriteFull(const std::string& path, vector<double> SimulationResults::*series);
+	void WriteProfile();
+	void WriteFinal();
+};
+
+const char* const SeriesNames[6] = {"GDP", "NPL", "Deposit", "Equity", "Loan", "RateNPL"};
+
+ResultsWriter::ResultsWriter(uint64_t seed) : Next(0), Closing(0), Replications(0), TraceStarted(0)
+{
+	if (TextResults)
+	{
+		Text.open("Results/Series.txt");
+		Damaged.open("Results/DamagedFirms.txt");
+		FinalNPL.open("Results/FinalNPL.txt");
+		FinalLiquidity.open("Results/FinalLiquidity.txt");
+		FinalSupport.open("Results/FinalGvtSupport.txt");
+		if ((!Text) or (!Damaged) or (!FinalNPL) or (!FinalLiquidity) or (!FinalSupport)){throw runtime_error("Results: cannot write the text results");}
+		Text << "Replication\tDay\tGDP\tNPL\tDeposit\tEquity\tLoan\tRateNPL\n";
+		Damaged << "Replication\tFirm\n";
+	}
+	if (BinaryResults)
+	{
+		Binary.open("Results/Series.bin", ios::binary);
+		if (!Binary){throw runtime_error("Results/Series.bin: cannot write the binary results");}
+		ResultsHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.Magic, ResultsMagic, 8);
+		header.Version = ResultsVersion;
+		header.Endian = 0x01020304;
+		header.Seed = seed;
+		Binary.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+	if (SNSE_PROFILE and (ProfileTrace.empty() == 0))
+	{
+		TraceFile.open(ProfileTrace);
+		if (!TraceFile){throw runtime_error(ProfileTrace + ": cannot write the trace");}
+		TraceFile.setf(ios::fixed);
+		TraceFile.precision(3);
+		TraceFile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	}
+	Thread = std::thread(&ResultsWriter::Run, this);
+}
 
-	TentativeOrdersH[0] = min_ratio.second*cVectorH[ID]; //Tentative order for the household
+ResultsWriter::~ResultsWriter()
+{
+	if (Thread.joinable())
+	{
+		try {Close();}
+		catch (...) {}
+	}
+}
 
-	for (unordered_map<int, double>::iterator itr=rcDemandFirmLevelH[ID].begin(); itr!=rcDemandFirmLevelH[ID].end();itr++)
+/*The result is moved to the queue: the replication doesn't use it afterwards*/
+void ResultsWriter::Push(int order, int replication, SimulationResults& result)
+{
 	{
-		TentativeOrdersH[(*itr).first] = min_ratio.second*OutPutFirmHoH[ID][(*itr).first][0];
+		lock_guard<mutex> lock(QueueMutex);
+		pair<int, SimulationResults>& item = Queue[order];
+		item.first = replication;
+		std::swap(item.second, result);
 	}
+	Ready.notify_one();
+}
 
-	double firm_production = CurrentProductionH[ID];
-	
-	while((almost_equal(firm_production,0.0) == 0) and (firm_production > 0.0) and (TentativeOrdersH.size()>1)) /*While firm ID has a production, it continues satisfying orders*/
+void ResultsWriter::Run()
+{
+	try
 	{
-		if(disaster == 0)
+		while (1)
 		{
-			for (unordered_map<int, double>::iterator itr=TentativeOrdersH.begin(); itr!=TentativeOrdersH.end();itr++)
+			pair<int, SimulationResults> item;
 			{
-				if ((*itr).first != 0)
-				{
-					rOrdersHoH[(*itr).first][ID]+=OutPutFirmHoH[ID][(*itr).first][0];
-					AccfInventoryHoH[(*itr).first][ID] +=OutPutFirmHoH[ID][(*itr).first][0];
-					AccsInventoryHoH[(*itr).first][InPutFirmHoH[(*itr).first][ID][1]]+=OutPutFirmHoH[ID][(*itr).first][0];
-					rzDemandVectorH[ID]+=OutPutFirmHoH[ID][(*itr).first][0];
-					GROrdersH[(*itr).first]+=OutPutFirmHoH[ID][(*itr).first][0];
-				}
-				else{rzDemandVectorH[ID]+=cVectorH[ID];}
-				firm_production=0.0;
+				std::unique_lock<mutex> lock(QueueMutex);
+				Ready.wait(lock, [this]() {return Closing or ((Queue.empty() == 0) and (Queue.begin()->first == Next));});
+				if (Queue.empty() or (Queue.begin()->first != Next)){break;}
+				std::swap(item, Queue.begin()->second);
+				Queue.erase(Queue.begin());
+				Next++;
 			}
+			Append(item.first, item.second);
+			if (RawSeries){std::swap(All[item.first], item.second);}
 		}
+		WriteFinal();
+	}
+	catch (...)
+	{
+		Failure = std::current_exception();
+	}
+}
+
+/*This procedure waits for the results in the queue to be written and writes the files of all replications*/
+void ResultsWriter::Close()
+{
+	{
+		lock_guard<mutex> lock(QueueMutex);
+		Closing = 1;
+	}
+	Ready.notify_one();
+	Thread.join();
+	if (Failure){std::rethrow_exception(Failure);}
+}
+
+void ResultsWriter::Append(int replication, const SimulationResults& result)
+{
+	const vector<double>* series[6] = {&result.GDP, &result.NPLH, &result.DepositH, &result.EquityH, &result.LoanH, &result.RateNPLH};
+	int days = result.GDP.size();
+	for (int s = 1; s < 6; s++)
+	{
+		if ((int)series[s]->size() != days){throw runtime_error("Results: series of different lengths in replication " + to_string(replication));}
+	}
+	for (int s = 0; s < 6; s++){Bands[s].Add(*series[s]);}
 
-		double sum_orders_first = 0;
-		for (unordered_map<int, double>::iterator itr=TentativeOrdersFirstH.begin(); itr!=TentativeOrdersFirstH.end();itr++)
+	if (TextResults)
+	{
+		ostringstream lines;
+		for (int i = 0; i < days; i++)
 		{
-			sum_orders_first+=TentativeOrdersFirstH[(*itr).first];
+			lines << replication << '\t' << i;
+			for (int s = 0; s < 6; s++){lines << '\t' << (*series[s])[i];}
+			lines << '\n';
 		}
+		Text << lines.str();
 
-		if((firm_production >sum_orders_first) || (almost_equal(firm_production,sum_orders_first)==1))
+		lines.str("");
+		for (size_t i = 0; i < result.DamagedFirms.size(); i++)
 		{
-			for (unordered_map<int, double>::iterator itr=TentativeOrdersFirstH.begin(); itr!=TentativeOrdersFirstH.end();itr++)
-			{
-				if ((*itr).first != 0)
-				{
-					rOrdersHoH[(*itr).first][ID]+= TentativeOrdersFirstH[(*itr).first];
-					AccfInventoryHoH[(*itr).first][ID] +=TentativeOrdersFirstH[(*itr).first];
-					AccsInventoryHoH[(*itr).first][InPutFirmHoH[(*itr).first][ID][1]]+=TentativeOrdersFirstH[(*itr).first];
-					GROrdersH[(*itr).first]+= TentativeOrdersFirstH[(*itr).first];
-				}
-				rzDemandVectorH[ID]+=TentativeOrdersFirstH[(*itr).first];
-			}
+			lines << replication << '\t' << result.DamagedFirms[i] << '\n';
+		}
+		Damaged << lines.str();
 
-			firm_production = 0.0;
+		double sum_loans = 0;
+		double sum_npl = 0;
+		double sum_dep = 0;
+		for (int i = 0; i < days; i++)
+		{
+			sum_loans+=result.LoanH[i];
+			sum_npl+=result.NPLH[i];
+			sum_dep+=result.DepositH[i];
 		}
+		FinalNPL << sum_npl/(sum_npl+sum_loans) << '\n';
+		FinalLiquidity << sum_loans/sum_dep << '\n';
+		FinalSupport << result.GvtSupport << '\n';
+		if ((!Text) or (!Damaged) or (!FinalNPL) or (!FinalLiquidity) or (!FinalSupport)){throw runtime_error("Results: cannot write the text results");}
+	}
 
-		double sum_orders = 0;
-		for (unordered_map<int, double>::iterator itr=TentativeOrdersH.begin(); itr!=TentativeOrdersH.end();itr++)
+	if (BinaryResults)
+	{
+		ResultsRecord record;
+		memset(&record, 0, sizeof(record));
+		record.Replication = replication;
+		record.Days = days;
+		record.Damaged = result.DamagedFirms.size();
+		record.GvtSupport = result.GvtSupport;
+		Binary.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		for (int s = 0; s < 6; s++)
 		{
-			sum_orders+=TentativeOrdersH[(*itr).first];
+			Binary.write(reinterpret_cast<const char*>(series[s]->data()), days*sizeof(double));
 		}
+		vector<int64_t> damaged(result.DamagedFirms.begin(), result.DamagedFirms.end());
+		Binary.write(reinterpret_cast<const char*>(damaged.data()), damaged.size()*sizeof(int64_t));
+		if (!Binary){throw runtime_error("Results/Series.bin: cannot write the binary results");}
+	}
+
+	Timing.Add(result.Timing);
+	Replications++;
+	if (TraceFile.is_open()){WriteTrace(replication, result.Trace);}
+}
+
+/*
+ * The trace is in the Chrome trace event format (chrome://tracing, Perfetto): one complete event per wall phase and step, one row per replication.
+*/
+void ResultsWriter::WriteTrace(int replication, const vector<TraceSpan>& trace)
+{
+	for (size_t k = 0; k < trace.size(); k++)
+	{
+		const TraceSpan& span = trace[k];
+		TraceFile << (TraceStarted ? ",\n" : "\n");
+		TraceFile << "{\"name\": \"" << ProfilePhases[span.Phase].Name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << replication
+			<< ", \"ts\": " << span.Start << ", \"dur\": " << span.Duration << ", \"args\": {\"step\": " << span.Step << "}}";
+		TraceStarted = 1;
+	}
+	if (!TraceFile){throw runtime_error(ProfileTrace + ": cannot write the trace");}
+}
+
+/*
+ * The profile of the run: for each phase timed in the build, its clock (wall: once per step; thread: at each call, summed over the threads), its calls and its time;
+ * then the number of each event.
+*/
+void ResultsWriter::WriteProfile()
+{
+	ofstream file(ProfileReport);
+	if (!file){throw runtime_error(ProfileReport + ": cannot write the profile");}
+	file << "{\n";
+	file << "\t\"Replications\": " << Replications << ",\n";
+	file << "\t\"Steps\": " << Timing.Calls[PhaseStep] << ",\n";
+	file << "\t\"Threads\": " << ProfileThreads() << ",\n";
+	file << "\t\"Phases\": [";
+	const char* separator = "\n";
+	for (int p = 0; p < PhaseCount; p++)
+	{
+		if (ProfiledPhase(p) == 0){continue;}
+		double mean = (Timing.Calls[p] > 0) ? 1e6*Timing.Seconds[p]/Timing.Calls[p] : 0;
+		file << separator << "\t\t{\"Name\": \"" << ProfilePhases[p].Name << "\", \"Clock\": \"" << (ProfilePhases[p].Wall ? "wall" : "thread") << "\", \"Calls\": " << Timing.Calls[p]
+			<< ", \"Seconds\": " << Timing.Seconds[p] << ", \"MicrosecondsPerCall\": " << mean << "}";
+		separator = ",\n";
+	}
+	file << "\n\t],\n";
+	file << "\t\"Events\": {";
+	for (int e = 0; e < EventCount; e++)
+	{
+		file << "\"" << ProfileEvents[e] << "\": " << Timing.Events[e] << ((e + 1 < EventCount) ? ", " : "");
+	}
+	file << "}\n}\n";
+	if (!file){throw runtime_error(ProfileReport + ": cannot write the profile");}
+}
+
+/*One line per day, one column per replication*/
+void ResultsWriter::WriteFull(const std::string& path, vector<double> SimulationResults::*series)
+{
+	size_t days = 0;
+	for (map<int, SimulationResults>::iterator it = All.begin(); it != All.end(); ++it){days = std::max(days, (it->second.*series).size());}
 
-		if (sum_orders > firm_production)
+	ostringstream lines;
+	for (size_t i = 0; i < days; i++)
+	{
+		for (map<int, SimulationResults>::iterator it = All.begin(); it != All.end(); ++it)
 		{
+			const vector<double>& values = it->second.*series;
+			if (i < values.size()){lines << values[i];}
+			lines << '\t';
+		}
+		lines << '\n';
+	}
+	ofstream file(path);
+	file << lines.str();
+	if (!file){throw runtime_error(path + ": cannot write the results");}
+}
+
+void ResultsWriter::WriteFinal()
+{
+	for (ofstream* file : {&Text, &Damaged, &Binary, &FinalNPL, &FinalLiquidity, &FinalSupport}){file->close();}
+	if (TraceFile.is_open())
+	{
+		TraceFile << "\n]}\n";
+		TraceFile.close();
+		if (!TraceFile){throw runtime_error(ProfileTrace + ": cannot write the trace");}
+	}
+	if (SNSE_PROFILE and (ProfileReport.empty() == 0)){WriteProfile();}
+	if (TextResults == 0){return;}
 
-			double Initial_OutPut = 0;
-			for (unordered_map<int, double>::iterator itr=TentativeOrdersH.begin(); itr!=TentativeOrdersH.end();itr++)
+	for (int s = 0; s < 6; s++){Bands[s].Write(std::string("Results/Bands") + SeriesNames[s] + ".txt");}
+	if (RawSeries)
+	{
+		WriteFull("Results/FullGDP.txt", &SimulationResults::GDP);
+		WriteFull("Results/FullLoan.txt", &SimulationResults::LoanH);
+		WriteFull("Results/FullNPL.txt", &SimulationResults::NPLH);
+		WriteFull("Results/FullNPLRate.txt", &SimulationResults::RateNPLH);
+		WriteFull("Results/FullDeposit.txt", &SimulationResults::DepositH);
+	}
+}
+
+/*
+ * The jobs are independent: a pool of threads takes them one by one until all are done.
+ * When several jobs run at the same time, the parallel loops inside a job use one thread, so the cores are not oversubscribed.
+ * The calling thread also runs jobs: its number of OpenMP threads is restored when the jobs are done, also after an error.
+ * The first error stops the pool and is thrown again once all threads are finished.
+*/
+
+void RunJobs(int count, const std::function<void(int)>& job)
+{
+	int threads = ReplicationThreads;
+	if (threads <= 0){threads = std::thread::hardware_concurrency();}
+	if (threads <= 0){threads = 1;}
+	threads = std::max(1, std::min(threads, count));
+
+#ifdef _OPENMP
+	int omp_threads = omp_get_max_threads();
+#endif
+	std::atomic<int> next(0);
+	std::exception_ptr failure; //First error of a job; the other threads stop taking jobs
+	mutex failure_mutex;
+	auto worker = [&]() {
+#ifdef _OPENMP
+		if (threads > 1){omp_set_num_threads(1);}
+#endif
+		for (int k = next++; k < count; k = next++)
+		{
+			try
 			{
-				if ((*itr).first != 0){Initial_OutPut+=OutPutFirmHoH[ID][(*itr).first][0];}
-				else{Initial_OutPut+=cVectorH[ID];}
+				job(k);
 			}
-			double effective_ratio = firm_production/Initial_OutPut;
-			for (unordered_map<int, double>::iterator itr=TentativeOrdersH.begin(); itr!=TentativeOrdersH.end();itr++)
+			catch (...)
 			{
-				if ((*itr).first != 0)
-				{
-					rOrdersHoH[(*itr).first][ID]+=effective_ratio*OutPutFirmHoH[ID][(*itr).first][0];
-					AccfInventoryHoH[(*itr).first][ID] +=effective_ratio*OutPutFirmHoH[ID][(*itr).first][0];
-					AccsInventoryHoH[(*itr).first][InPutFirmHoH[(*itr).first][ID][1]]+=effective_ratio*OutPutFirmHoH[ID][(*itr).first][0];
-					rzDemandVectorH[ID]+=effective_ratio*OutPutFirmHoH[ID][(*itr).first][0];
-					GROrdersH[(*itr).first]+=effective_ratio*OutPutFirmHoH[ID][(*itr).first][0];
-				}
-				else{rzDemandVectorH[ID]+=effective_ratio*cVectorH[ID];}
+				lock_guard<mutex> lock(failure_mutex);
+				if (!failure){failure = std::current_exception();}
+				next = count;
 			}
-			firm_production=0.0;
 		}
-		else
+	};
+
+	vector<std::thread> pool;
+	for (int k = 1; k < threads; k++){pool.push_back(std::thread(worker));}
+	worker();
+	for (size_t k = 0; k < pool.size(); k++){pool[k].join();}
+#ifdef _OPENMP
+	omp_set_num_threads(omp_threads);
+#endif
+	if (failure){std::rethrow_exception(failure);}
+}
+
+/*
+ * The network is loaded and the state at t = 0 is built once, in the snapshot; each replication copies the snapshot and only draws its random variables.
+ * The replications run in the pool of jobs and hand their results to the writer.
+ * The random numbers of a replication only depend on the master seed and the replication, so the results don't depend on the thread which runs it.
+*/
+
+void RunReplications(const Network& network, const vector<int>& replications, ResultsWriter& writer, uint64_t seed, bool resume)
+{
+	Simulation snapshot(network, -1, seed);
+	snapshot.Initial_Data();
+
+	RunJobs(replications.size(), [&](int k) {
+		Simulation simulation(snapshot, replications[k]);
+		if (!(resume and simulation.Read_Checkpoint())){simulation.Draw_Inventory();}
+		simulation.Simulate();
+		simulation.Bank_Balances();
+		SimulationResults result = simulation.Results();
+		{
+			lock_guard<mutex> lock(ConsoleMutex);
+			cout << "replication ; " << replications[k] << " ; " << result.GDP.size() << " days ; GDP ; " << result.GDP.back() << endl;
+		}
+		writer.Push(k, replications[k], result);
+	});
+}
+
+/*
+ * Parameter sweep
+ * The sweep file has a first line with the names of the swept parameters, then one line per parameter set with their values; the other parameters keep their values of Initial_Data.
+ * The state at t = 0 doesn't depend on the parameters, so all sets share the snapshot; a job is one parameter set and one replication, and it sets the parameters on its copy.
+ * A replication draws the same random numbers for all sets (common random numbers), so the differences between sets come from the parameters only.
+ * The results are written in the order of the jobs, one line per job: set; replication; parameters; summary of the replication.
+*/
+
+/*The lines of the jobs are written in the order of the jobs: a job which finishes before the previous ones leaves its line for them*/
+struct OrderedLines
+{
+	std::string Path;
+	ofstream File;
+	vector<std::string> Lines;
+	vector<char> Done;
+	int Written;
+	mutex LinesMutex;
+
+	OrderedLines(const std::string& path, int count) : Path(path), File(path), Lines(count), Done(count, 0), Written(0)
+	{
+		if (!File){throw runtime_error(Path + ": cannot write the results");}
+	}
+
+	void Put(int k, const std::string& line)
+	{
+		lock_guard<mutex> lock(LinesMutex);
+		Lines[k] = line;
+		Done[k] = 1;
+		while ((Written < (int)Lines.size()) and Done[Written])
+		{
+			File << Lines[Written];
+			std::string().swap(Lines[Written]);
+			Written++;
+		}
+		File.flush();
+		if (!File){throw runtime_error(Path + ": cannot write the results");}
+	}
+};
+
+struct ParameterSweep
+{
+	vector<int> Parameters; //Index in ModelParameters of each column
+	vector<double> Values; //Set by set
+	int Sets() const {return Parameters.empty() ? 0 : Values.size()/Parameters.size();}
+};
+
+ParameterSweep ReadSweep(const std::string& path)
+{
+	MappedFile file(path);
+	if (file.Begin == file.End){throw runtime_error(path + ": no parameter set");}
+	const char* header_end = static_cast<const char*>(memchr(file.Begin, '\n', file.End - file.Begin));
+	if (header_end == 0){header_end = file.End;}
+
+	ParameterSweep sweep;
+	for (const char* p = file.Begin; p < header_end;)
+	{
+		while ((p < header_end) and IsBlank(*p)){p++;}
+		const char* name = p;
+		while ((p < header_end) and !IsBlank(*p)){p++;}
+		if (p == name){continue;}
+		int index = ParameterIndex(std::string(name, p));
+		if (index < 0){throw runtime_error(path + ":1: unknown parameter " + std::string(name, p));}
+		sweep.Parameters.push_back(index);
+	}
+	if (sweep.Parameters.empty()){throw runtime_error(path + ":1: no parameter");}
+
+	std::string format(sweep.Parameters.size(), 'd');
+	const char* body = std::min(header_end + 1, file.End);
+	try {ParseLines(body, file.End, format.c_str(), sweep.Values);}
+	catch (const ParseError& error)
+	{
+		long line = 1 + std::count(file.Begin, error.Position, '\n');
+		throw runtime_error(path + ":" + to_string(line) + ": " + error.Message);
+	}
+	for (size_t v = 0; v < sweep.Values.size(); v++)
+	{
+		const SimulationParameter& parameter = ModelParameters[sweep.Parameters[v % sweep.Parameters.size()]];
+		if (parameter.Integer and (sweep.Values[v] != std::floor(sweep.Values[v])))
+		{
+			throw runtime_error(path + ": set " + to_string(v/sweep.Parameters.size()) + ": " + parameter.Name + " must be an integer");
+		}
+	}
+	if (sweep.Sets() == 0){throw runtime_error(path + ": no parameter set");}
+	return sweep;
+}
+
+void RunSweep(const Network& network, const ParameterSweep& sweep, uint64_t seed)
+{
+	Simulation snapshot(network, -1, seed);
+	snapshot.Initial_Data();
+
+	int columns = sweep.Parameters.size();
+	int count = sweep.Sets()*GlobalSim;
+	OrderedLines output(SweepResults, count);
+	output.File << "Set\tReplication";
+	for (int c = 0; c < columns; c++){output.File << '\t' << ModelParameters[sweep.Parameters[c]].Name;}
+	output.File << "\tInitialGDP\tMinGDP\tFinalGDP\tGDPLoss\tFinalNPL\tFinalLiquidity\tGvtSupport\tDamagedFirms\n";
+
+	RunJobs(count, [&](int k) {
+		int set = k/GlobalSim;
+		int replication = k % GlobalSim;
+		Simulation simulation(snapshot, replication);
+		for (int c = 0; c < columns; c++){simulation.Set_Parameter(sweep.Parameters[c], sweep.Values[set*columns + c]);}
+		simulation.Draw_Inventory();
+		simulation.Simulate();
+		simulation.Bank_Balances();
+		SimulationResults result = simulation.Results();
+
+		/*GDPLoss: the GDP lost over the simulation, in days of GDP at t = 0*/
+		double initial = result.GDP.empty() ? 0 : result.GDP[0];
+		double minimum = initial;
+		double loss = 0;
+		double sum_loans = 0;
+		double sum_npl = 0;
+		double sum_dep = 0;
+		for (size_t i = 0; i < result.GDP.size(); i++)
+		{
+			minimum = std::min(minimum, result.GDP[i]);
+			loss += (initial - result.GDP[i])/initial;
+			sum_loans+=result.LoanH[i];
+			sum_npl+=result.NPLH[i];
+			sum_dep+=result.DepositH[i];
+		}
+
+		ostringstream line;
+		line << set << '\t' << replication;
+		for (int c = 0; c < columns; c++){line << '\t' << sweep.Values[set*columns + c];}
+		line << '\t' << initial << '\t' << minimum << '\t' << (result.GDP.empty() ? 0 : result.GDP.back()) << '\t' << loss << '\t' << sum_npl/(sum_npl+sum_loans)
+				<< '\t' << sum_loans/sum_dep << '\t' << result.GvtSupport << '\t' << result.DamagedFirms.size() << '\n';
+		output.Put(k, line.str());
+	});
+}
+
+/*
+ * Calibration
+ * The candidates are the parameter sets of a sweep file; each is scored against the observed IIP over GlobalSim replications.
+ * The target file has one line per observation: day; IIP divided by its level before the shock. The simulated index is GDP[day]/GDP[0].
+ * The loss of a replication is the sum over the observed days of the squared (CalibrationLoss = 0) or absolute (1) differences; the loss of a candidate is the mean over its replications.
+ * The loss only grows with the days, so it is updated at each step: a candidate is abandoned as soon as its partial loss exceeds the loss of the best complete candidate.
+ * The best candidate is never abandoned, so it doesn't depend on the threads; the step at which the other candidates are abandoned does.
+*/
+
+struct CalibrationTargetSeries
+{
+	vector<double> Index; //Observed index by day; NaN for the days without observation
+};
+
+CalibrationTargetSeries ReadCalibrationTarget(const std::string& path)
+{
+	Table table = ReadTable(path, "id");
+	if (table.Rows() == 0){throw runtime_error(path + ": no observation");}
+	CalibrationTargetSeries target;
+	target.Index.assign(SimTime, numeric_limits<double>::quiet_NaN());
+	for (int r = 0; r < table.Rows(); r++)
+	{
+		int day = table.Int(r, 0);
+		if ((day < 0) or (day >= SimTime)){throw runtime_error(path + ": day " + to_string(day) + " outside the simulation");}
+		target.Index[day] = table.Double(r, 1);
+	}
+	return target;
+}
+
+void RunCalibration(const Network& network, const ParameterSweep& candidates, const CalibrationTargetSeries& target, uint64_t seed)
+{
+	Simulation snapshot(network, -1, seed);
+	snapshot.Initial_Data();
+
+	int columns = candidates.Parameters.size();
+	int count = candidates.Sets();
+	OrderedLines output(CalibrationResults, count);
+	output.File << "Set";
+	for (int c = 0; c < columns; c++){output.File << '\t' << ModelParameters[candidates.Parameters[c]].Name;}
+	output.File << "\tComplete\tLoss\tSteps\n";
+
+	mutex best_mutex;
+	double best_loss = numeric_limits<double>::infinity();
+	int best_set = -1;
+	std::atomic<long> steps_done(0);
+
+	RunJobs(count, [&](int set) {
+		/*The bound is read at each step: it falls as the other candidates complete*/
+		double bound;
+		{
+			lock_guard<mutex> lock(best_mutex);
+			bound = best_loss;
+		}
+
+		double sum = 0; //Loss of the replications so far, summed
+		long steps = 0;
+		bool complete = 1;
+		for (int replication = 0; (replication < GlobalSim) and complete; replication++)
 		{
-			for (unordered_map<int, double>::iterator itr=TentativeOrdersH.begin(); itr!=TentativeOrdersH.end();itr++)
+			Simulation simulation(snapshot, replication);
+			for (int c = 0; c < columns; c++){simulation.Set_Parameter(candidates.Parameters[c], candidates.Values[set*columns + c]);}
+			simulation.Draw_Inventory();
+			while (simulation.t < SimTime)
 			{
-				if ((*itr).first != 0)
+				int day = simulation.t;
+				simulation.Step();
+				steps++;
+				double observed = target.Index[day];
+				if (std::isnan(observed)){continue;}
+				double error = simulation.GDP[day]/simulation.GDP[0] - observed;
+				sum += (CalibrationLoss == 0) ? error*error : std::fabs(error);
+				if (std::isnan(sum) or (sum/GlobalSim > bound))
 				{
-					rOrdersHoH[(*itr).first][ID]+= TentativeOrdersH[(*itr).first];
-					AccfInventoryHoH[(*itr).first][ID] +=TentativeOrdersH[(*itr).first];
-					AccsInventoryHoH[(*itr).first][InPutFirmHoH[(*itr).first][ID][1]]+=TentativeOrdersH[(*itr).first];
-					GROrdersH[(*itr).first]+= TentativeOrdersH[(*itr).first];
+					complete = 0;
+					break;
 				}
-				firm_production-=TentativeOrdersH[(*itr).first];
-				rzDemandVectorH[ID]+=TentativeOrdersH[(*itr).first];
-				TentativeOrdersFirstH[(*itr).first]-=TentativeOrdersH[(*itr).first];
-			}
-			TentativeOrdersH.erase(min_ratio.first);
-			RatioOrdersH.erase(min_ratio.first);
-			TentativeOrdersFirstH.erase(min_ratio.first);
-			for (unordered_map<int, double>::iterator itr=RatioOrdersH.begin(); itr!=RatioOrdersH.end();itr++)
-			{
-				RatioOrdersH[(*itr).first]-=min_ratio.second;
-				if ((almost_equal2(RatioOrdersH[(*itr).first] , (double)0) == 1) || (RatioOrdersH[(*itr).first] < 0))
 				{
-					TentativeOrdersH.erase((*itr).first);
-					RatioOrdersH.erase((*itr).first);
-					TentativeOrdersFirstH.erase((*itr).first);
+					lock_guard<mutex> lock(best_mutex);
+					bound = best_loss;
 				}
 			}
-			if(RatioOrdersH.size()>1)
-			{
-				min_ratio = *min_element(RatioOrdersH.begin(), RatioOrdersH.end(), compare);
+		}
+		steps_done += steps;
 
-				for (unordered_map<int, double>::iterator itr=TentativeOrdersH.begin(); itr!=TentativeOrdersH.end();itr++)
-				{
-					if((*itr).first!=0)
-					{
-						TentativeOrdersH[(*itr).first] = min_ratio.second*OutPutFirmHoH[ID][(*itr).first][0];
-					}
-					else
-					{
-						TentativeOrdersH[(*itr).first] = min_ratio.second*cVectorH[ID];
-					}
-				}
+		double loss = complete ? sum/GlobalSim : numeric_limits<double>::quiet_NaN();
+		if (complete)
+		{
+			lock_guard<mutex> lock(best_mutex);
+			if ((loss < best_loss) or ((loss == best_loss) and (set < best_set)))
+			{
+				best_loss = loss;
+				best_set = set;
 			}
 		}
-	}
+
+		ostringstream line;
+		line << set;
+		for (int c = 0; c < columns; c++){line << '\t' << candidates.Values[set*columns + c];}
+		line << '\t' << complete << '\t' << (complete ? loss : sum/GlobalSim) << '\t' << steps << '\n';
+		output.Put(set, line.str());
+	});
+
+	lock_guard<mutex> lock(ConsoleMutex);
+	cout << "Best set ; " << best_set << " ; loss ; " << best_loss << endl;
+	cout << "Simulated steps ; " << steps_done << " of " << (long)count*GlobalSim*SimTime << endl;
 }
 
-void RationingCustomers(int ID)
+/*
+ * Synthetic economies
+ * A synthetic economy has all the input files of Network::Load, so the simulator can be measured at any size without real data.
+ * The supply network is a Chung-Lu network with power law degrees: each supplier draws its number of customers from a power law,
+ * and its customers are drawn in proportion to their weight, also drawn from a power law; a drawn customer is kept once.
+ * The weights of the links and the consumption of the households are log-normal; the production of a firm is its sales plus its consumption.
+ * All firms are active: an inactive firm has no production, so it can't have suppliers, consumption or damage.
+ * Each firm has one to three banks, drawn in proportion to the size of the banks; its balance sheet sums its accounts, and its equity closes it.
+ * The firm k gets the ID 1 + (k*2654435761 mod firms): the order of the files is not the order of the IDs.
+ * All draws of a firm come from its own random streams, so the files only depend on the number of firms and SyntheticSeed.
+*/
+
+inline int SyntheticID(int k, int firms) {return 1 + (int)(((uint64_t)k*2654435761ULL) % (uint64_t)firms);}
+
+/*x >= 1 with P(X > x) = x^-(exponent - 1)*/
+inline double PowerLaw(double u, double exponent) {return pow(1 - u, -1/(exponent - 1));}
+
+/*Box-Muller draw of a normal variable from two uniform numbers*/
+inline double LogNormal(double u, double v, double sigma) {return exp(sigma*sqrt(-2*log(1 - u))*cos(6.283185307179586*v));}
+
+/*The index drawn in proportion to the cumulative weights*/
+inline int DrawIndex(const vector<double>& cumulative, double u)
 {
-	rzDemandVectorH[ID]=0.0;
+	int k = std::upper_bound(cumulative.begin(), cumulative.end(), u*cumulative.back()) - cumulative.begin();
+	return std::min(k, (int)cumulative.size() - 1);
+}
 
-	if(CurrentProductionH[ID]>cVectorH[ID])
+void MakeDirectory(const std::string& path)
+{
+	for (size_t k = 1; k <= path.size(); k++)
 	{
-		rzDemandVectorH[ID]+=cVectorH[ID];
+		if ((k < path.size()) and (path[k] != '/') and (path[k] != '\\')){continue;}
+		std::string prefix = path.substr(0, k);
+#ifdef _WIN32
+		CreateDirectoryA(prefix.c_str(), 0);
+#else
+		mkdir(prefix.c_str(), 0755);
+#endif
 	}
+}
 
-	else
+/*This procedure writes the input files of a synthetic economy of the given number of firms in the directory, which ends with a separator*/
+void GenerateEconomy(int firms, const std::string& directory)
+{
+	if (firms < 2){throw runtime_error("Synthetic economy: at least 2 firms");}
+	MakeDirectory(directory);
+	vector<ofstream> files(InputFileCount);
+	for (int f = 0; f < InputFileCount; f++)
 	{
-		rzDemandVectorH[ID]+=CurrentProductionH[ID];
+		files[f].open(directory + InputFiles[f]);
+		if (!files[f]){throw runtime_error(directory + InputFiles[f] + ": cannot write the synthetic economy");}
+		files[f].setf(ios::fixed);
+		files[f].precision(3);
 	}
-}
+	ofstream& links = files[0];
+	ofstream& clusters = files[1];
+	ofstream& profit = files[2];
+	ofstream& location = files[3];
+	ofstream& sector = files[4];
+	ofstream& community = files[5];
+	ofstream& accounts = files[6];
+	ofstream& balance = files[7];
+	ofstream& consumption = files[8];
+	ofstream& production = files[9];
+	ofstream& list = files[10];
 
-void Trading(int ID)
-{
-	if (almost_equal2(CurrentProductionH[ID] , rcDemandVectorH[ID])==0)
+	/*
+	 * Supply network
+	*/
+	vector<double> weights(firms);
+	for (int k = 0; k < firms; k++)
+	{
+		RandomStream draws(SyntheticSeed, k, SyntheticDraws);
+		weights[k] = (k > 0 ? weights[k-1] : 0) + PowerLaw(draws.Uniform(0), SyntheticExponent);
+	}
+	int max_degree = std::max(1, firms/10);
+	vector<double> sales(firms, 0);
+	vector<int> customers;
+	int64_t link_count = 0;
+	for (int k = 0; k < firms; k++)
 	{
-		if ((ListSupplier.find(ID) != ListSupplier.end())==0)
+		RandomStream draws(SyntheticSeed, k, SyntheticDraws);
+		RandomStream link_draws(SyntheticSeed, k, SyntheticLinkDraws);
+		int degree = std::min(max_degree, (int)(SyntheticMinDegree*PowerLaw(draws.Uniform(1), SyntheticExponent)));
+		customers.clear();
+		for (int d = 0; d < degree; d++)
 		{
-			RationingCustomers(ID);
+			int j = DrawIndex(weights, link_draws.NextUniform());
+			if (j != k){customers.push_back(j);}
 		}
-		else
+		std::sort(customers.begin(), customers.end());
+		customers.erase(std::unique(customers.begin(), customers.end()), customers.end());
+		for (size_t c = 0; c < customers.size(); c++)
 		{
-			Rationing(ID);
+			double u = link_draws.NextUniform();
+			double v = link_draws.NextUniform();
+			double weight = 10*LogNormal(u, v, 1.0);
+			sales[k] += weight;
+			links << SyntheticID(k, firms) << '\t' << SyntheticID(customers[c], firms) << '\t' << weight << '\n';
 		}
+		link_count += customers.size();
 	}
+	vector<double>().swap(weights);
 
-	else
+	/*
+	 * Firms and banks
+	*/
+	int banks = std::max(3, firms/std::max(1, SyntheticFirmsPerBank));
+	vector<double> bank_sizes(banks);
+	for (int b = 0; b < banks; b++)
 	{
-		rzDemandVectorH[ID]=cVectorH[ID]; //Ci: consumption for households
-        double rc;
-		for (unordered_map<int, double>::iterator itr=rcDemandFirmLevelH[ID].begin(); itr!=rcDemandFirmLevelH[ID].end();itr++)
+		RandomStream draws(SyntheticSeed, (uint64_t)firms + b, SyntheticDraws);
+		bank_sizes[b] = (b > 0 ? bank_sizes[b-1] : 0) + PowerLaw(draws.Uniform(0), SyntheticExponent);
+	}
+	for (int k = 0; k < firms; k++)
+	{
+		RandomStream draws(SyntheticSeed, k, SyntheticDraws);
+		int id = SyntheticID(k, firms);
+		int s = 1 + (int)(draws.Uniform(2)*SyntheticSectors);
+		int p = 1 + (int)(pow(draws.Uniform(3), 2)*SyntheticPrefectures); //The first prefectures have more firms
+		double c = 10*LogNormal(draws.Uniform(4), draws.Uniform(5), 1.0);
+		double pini = sales[k] + c;
+
+		clusters << id << '\t' << 0.3*draws.Uniform(6) << '\t' << 1 + 20*draws.Uniform(7) << '\n';
+		profit << id << ' ' << 0.02 + 0.2*draws.Uniform(8) << '\n';
+		location << id << '\t' << p << '\n';
+		sector << id << '\t' << s << "\tSECTOR_" << s << '\t' << s << "\tSECTOR_" << s << '\n';
+		community << id << '\t' << 1 + (int)(draws.Uniform(9)*SyntheticCommunities) << '\n';
+		consumption << id << '\t' << c << '\n';
+		production << id << '\t' << pini << '\n';
+		list << id << '\t' << s << '\t' << 1 + (int)(draws.Uniform(11)*1000000) << '\n';
+
+		int count = 1 + (int)(draws.Uniform(12)*3);
+		int chosen[3];
+		double deposit = 0;
+		double loan = 0;
+		for (int a = 0; a < count; a++)
 		{
-			rc = rcDemandFirmLevelH[ID][(*itr).first];
-			rOrdersHoH[(*itr).first][ID]=rc;
-			AccfInventoryHoH[(*itr).first][ID] +=rc;
-			AccsInventoryHoH[(*itr).first][InPutFirmHoH[(*itr).first][ID][1]]+=rc;
-			rzDemandVectorH[ID]+=rc;
-			GROrdersH[(*itr).first]+=rc;
+			int b = DrawIndex(bank_sizes, draws.Uniform(13 + 3*a));
+			if (std::find(chosen, chosen + a, b) != chosen + a){chosen[a] = -1; continue;}
+			chosen[a] = b;
+			double account_loan = pini*(0.05 + 0.25*draws.Uniform(14 + 3*a))/count;
+			double account_deposit = pini*(0.1 + 0.4*draws.Uniform(15 + 3*a))/count;
+			accounts << id << ' ' << b + 1 << ' ' << account_loan << ' ' << account_deposit << '\n';
+			loan += account_loan;
+			deposit += account_deposit;
 		}
+		double oa = pini*(1 + draws.Uniform(22));
+		double ol = pini*0.3*draws.Uniform(23);
+		balance << id << ' ' << deposit << ' ' << oa << ' ' << loan << ' ' << deposit + oa - loan - ol << ' ' << ol << '\n';
 	}
 
-	FirmBSH[ID][0]+=ProfitToSalesH[ID]*rzDemandVectorH[ID];
+	for (int f = 0; f < InputFileCount; f++)
+	{
+		files[f].close();
+		if (!files[f]){throw runtime_error(directory + InputFiles[f] + ": cannot write the synthetic economy");}
+	}
+	cout << "Synthetic economy ; " << directory << " ; " << firms << " firms ; " << link_count << " links ; " << banks << " banks" << endl;
 }
 
+/*
+ * Benchmark
+ * For each size of BenchmarkSizes, the synthetic economy is generated if needed, then the run is timed phase by phase:
+ * parsing of the input files, writing and reading of the network cache, Initial_Data, Draw_Inventory and BenchmarkSteps steps of one replication,
+ * with the profile of the phases of the steps. The resident memory is measured after the load and after the steps.
+ * A size whose GDP is not finite stops the benchmark: its times would measure NaN arithmetic, not the model.
+ * The results are written in BenchmarkResults after each size, so a size which runs out of memory leaves the results of the smaller sizes.
+*/
 
-void CannotPay(int ID)
+/*Resident memory of the process and its peak, in bytes*/
+void ResidentMemory(uint64_t& current, uint64_t& peak)
 {
-    /*
-     * Firms who cannot pay are those who could not get a loan.
-     * These firms will try to buy only based on there available deposit.
-     * They try to minimize their expenses.
-    */
-	double Quantity = (GROrdersH[ID]- FirmBSH[ID][0])/GROrdersH[ID];
-	for(unordered_map<int, double >::iterator itr=rOrdersHoH[ID].begin();itr!=rOrdersHoH[ID].end();itr++)
+	current = 0;
+	peak = 0;
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
 	{
-		double order_to_return = rOrdersHoH[ID][(*itr).first]*Quantity;
-		rOrdersHoH[ID][(*itr).first] -= order_to_return;
-		AccfInventoryHoH[ID][(*itr).first] -= order_to_return;
-		AccsInventoryHoH[ID][InPutFirmHoH[ID][(*itr).first][1]]-= order_to_return;
-		rzDemandVectorH[(*itr).first]-= order_to_return;
-		FirmBSH[(*itr).first][0]-= ProfitToSalesH[(*itr).first]*order_to_return;
-		GROrdersH[ID]-= order_to_return;
+		current = counters.WorkingSetSize;
+		peak = counters.PeakWorkingSetSize;
 	}
-
-	ExpensesH[ID]+=GROrdersH[ID];
-}
-
-void LoanDemandSupply(int ID)
-{
-    double TotalLoanDde = dOrdersH[ID] - FirmBSH[ID][0];
-
-    for(unordered_map<int, vector < double > >::iterator  itr=FirmBankHoH[ID].begin(); itr!=FirmBankHoH[ID].end();itr++)
-    {
-    	/*
-    	 * If equity is positive: the firm get loans from all its banks
-    	*/
-    	double ln = TotalLoanDde/FirmBankHoH[ID].size();
-    	double rate = (1 - CurrentProductionH[ID]/ProductionIniH[ID])*0.04;
-    	double periodic = ln/LoanMaturity;
-    	if (ShortInterestRate == 1) {periodic = ln*rate/(1-pow(1+rate,-LoanMaturity));}
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(ln); //The amount of loans
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(rate); //The applied interest rate
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(periodic); //The amount paid monthly
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(0); //Number of paid monthly
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(0); //Count periods of non-payment before declaring loan default
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(0); //Index for loan situation; 0: healthy loan with payment; 1: paid loan 2: defaulted loan
-    	CurrentLoansHoH[ID][(*itr).first][LoanKeyHoH[ID][(*itr).first]].push_back(0); //0: short-term loan; 1: long-term loan
-
-    	LoanKeyHoH[ID][(*itr).first]++;
-    	PayByLoanHoH[ID][(*itr).first]=ln;
-
-    	/*
-    	 * After getting loan: Update of the balance sheet
-    	 * 1- Rise the level of loans
-    	 * 2- Rise the level of deposits
-    	*/
-
-    	FirmBSH[ID][2]+=ln;
-    	FirmBSH[ID][0]+=ln;
-
-    	/*
-    	 * Update the accounts of the firm in their banks
-    	*/
-    	FirmBankHoH[ID][(*itr).first][0]+=ln;
-    	FirmBankHoH[ID][(*itr).first][1]+=ln;
-    }
+#else
+	long pages = 0;
+	ifstream statm("/proc/self/statm");
+	if (statm >> pages >> pages){current = (uint64_t)pages*sysconf(_SC_PAGESIZE);}
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0){peak = (uint64_t)usage.ru_maxrss*1024;}
+#endif
+	peak = std::max(peak, current);
 }
 
-void NeedLoan(int ID)
+void RunBenchmark(const vector<int>& sizes, uint64_t seed)
 {
-	if(dOrdersH[ID] <=  FirmBSH[ID][0]){LoanFlagH[ID] = 2;}
-	else
+	typedef std::chrono::steady_clock Clock;
+	auto seconds = [](Clock::time_point start) {return std::chrono::duration<double>(Clock::now() - start).count();};
+	CheckpointEvery = 0;
+	SimTime = BenchmarkSteps;
+	vector<std::string> records;
+	for (size_t z = 0; z < sizes.size(); z++)
 	{
-		if(BankRiskManager == 1)
+		int firms = sizes[z];
+		std::string directory = BenchmarkDirectory + to_string(firms) + "/";
+		InputDirectory = directory;
+
+		Clock::time_point start = Clock::now();
+		bool generated = (MappedFile(InputPath(LinksFile)).Begin == 0);
+		if (generated){GenerateEconomy(firms, directory);}
+		double generate = generated ? seconds(start) : 0;
+
+		Network network;
+		start = Clock::now();
+		network.Load();
+		double parse = seconds(start);
+		start = Clock::now();
+		network.SaveCache(directory + "Network.cache");
+		double save_cache = seconds(start);
+		double load_cache;
 		{
-			double TotalLoanDde = dOrdersH[ID] - FirmBSH[ID][0];
-			double risk = (TotalLoanDde + FirmBSH[ID][2])/(FirmBSH[ID][3] + TotalLoanDde + FirmBSH[ID][2]);
-			if(risk < LimitSolvencyRatio)
-			{
-				LoanDemandSupply(ID);
-				FirmsNoLoansH[ID] = 0;
-			}
-			else
-			{
-				FirmsNoLoansH[ID]++;
-				if((FirmsNoLoansH[ID] > 0) and (HelpFirms == 1))
-				{
-					FirmBSH[ID][0]+=TotalLoanDde;
-					GvtSupport+=TotalLoanDde;
-					FirmsNoLoansH[ID] = 0;
-				}
-			}
+			Network cached;
+			start = Clock::now();
+			if (cached.LoadCache(directory + "Network.cache") == 0){throw runtime_error(directory + "Network.cache: cannot read the network cache");}
+			load_cache = seconds(start);
 		}
-
-		else if(BankRiskManager == 2)
+		uint64_t memory_load, peak;
+		ResidentMemory(memory_load, peak);
+
+		Simulation snapshot(network, -1, seed);
+		start = Clock::now();
+		snapshot.Initial_Data();
+		double initial_data = seconds(start);
+		Simulation simulation(snapshot, 0);
+		start = Clock::now();
+		simulation.Draw_Inventory();
+		double draw_inventory = seconds(start);
+		start = Clock::now();
+		simulation.Simulate();
+		double steps = seconds(start);
+		for (size_t d = 0; d < simulation.GDP.size(); d++)
 		{
-			if(FirmBSH[ID][3] > 0.0)
+			if (std::isfinite(simulation.GDP[d]) == 0)
 			{
-				LoanDemandSupply(ID);
+				throw runtime_error("Benchmark: the GDP of the economy of " + to_string(firms) + " firms is not finite at step " + to_string(d) + ", its times are not recorded");
 			}
 		}
-
-		else if(BankRiskManager == 0) {LoanDemandSupply(ID);}
-
+		uint64_t memory_steps;
+		ResidentMemory(memory_steps, peak);
+
+		ProfileCounters timing;
+		for (size_t k = 0; k < simulation.Timing.size(); k++){timing.Add(simulation.Timing[k]);}
+		int active = 0;
+		for (size_t i = 0; i < network.FirmIDs.size(); i++){active += network.Profile.Active[i];}
+
+		ostringstream record;
+		record << "\t\t{\"Firms\": " << firms << ", \"NetworkFirms\": " << network.FirmIDs.size() << ", \"ActiveFirms\": " << active
+			<< ", \"Links\": " << network.OutLinks.Firm.size() << ", \"Accounts\": " << network.Accounts.Bank.size() << ", \"Banks\": " << network.Accounts.Banks.size() << ",\n";
+		record << "\t\t\"Seconds\": {\"Generate\": " << generate << ", \"Parse\": " << parse << ", \"SaveCache\": " << save_cache << ", \"LoadCache\": " << load_cache
+			<< ", \"Initial_Data\": " << initial_data << ", \"Draw_Inventory\": " << draw_inventory << ", \"Steps\": " << steps << ", \"PerStep\": " << steps/std::max(1, simulation.t) << "},\n";
+		record << "\t\t\"Phases\": {";
+		const char* separator = "";
+		for (int p = 0; p < PhaseCount; p++)
+		{
+			if (ProfiledPhase(p) == 0){continue;}
+			record << separator << "\"" << ProfilePhases[p].Name << "\": " << timing.Seconds[p];
+			separator = ", ";
+		}
+		record << "},\n";
+		record << "\t\t\"Memory\": {\"AfterLoad\": " << memory_load << ", \"AfterSteps\": " << memory_steps << ", \"Peak\": " << peak << "}}";
+		records.push_back(record.str());
+
+		ofstream file(BenchmarkResults);
+		if (!file){throw runtime_error(BenchmarkResults + ": cannot write the benchmark");}
+		file << "{\n\t\"SyntheticSeed\": " << SyntheticSeed << ",\n\t\"Seed\": " << seed << ",\n\t\"Steps\": " << BenchmarkSteps << ",\n\t\"Threads\": " << ProfileThreads()
+			<< ",\n\t\"Profile\": " << SNSE_PROFILE << ",\n\t\"ProfileCalls\": " << SNSE_PROFILE_CALLS << ",\n\t\"Sizes\": [\n";
+		for (size_t r = 0; r < records.size(); r++){file << records[r] << ((r + 1 < records.size()) ? ",\n" : "\n");}
+		file << "\t]\n}\n";
+		if (!file){throw runtime_error(BenchmarkResults + ": cannot write the benchmark");}
+
+		cout << "Benchmark ; " << firms << " firms ; parse ; " << parse << " s ; step ; " << steps/std::max(1, simulation.t) << " s ; peak memory ; " << peak << " bytes" << endl;
 	}
 }
 
-void Payment(int ID)
+/*
+ * Memory report
+ * The report lists the entries and the estimated bytes of each container of the network and of a replication: the bytes are those of the capacity of the vectors,
+ * and of the nodes and buckets of the sets and maps. The network is reported once loaded, the replication at step 0 and at each step of MemorySteps.
+ * The maps of the banks are filled with the banks of the accounts; a key of another bank can only come from a lookup with operator[], and is counted as a lookup key.
+ * The resident memory of the process is reported with the estimates, to show the memory which is not in the containers.
+*/
+
+struct MemoryReport
 {
-	if ((FirmBSH[ID][0] > GROrdersH[ID]) or (almost_equal2(FirmBSH[ID][0],GROrdersH[ID]) == 1))
+	struct Entry
 	{
-		double used_deposit = GROrdersH[ID];
-		//FirmBSH[ID][0]-=used_deposit;
-		/*
-		 * After payment, the new deposit is updated as a weight of current loans from each bank
-		*/
-		ExpensesH[ID]+=GROrdersH[ID];
+		std::string Container;
+		uint64_t Entries;
+		uint64_t Bytes;
+		uint64_t LookupKeys;
+	};
+	vector<Entry> Containers;
+
+	void Add(const std::string& container, uint64_t entries, uint64_t bytes, uint64_t lookup_keys = 0)
+	{
+		if (Containers.empty() or (Containers.back().Container != container)){Containers.push_back(Entry{container, 0, 0, 0});}
+		Containers.back().Entries += entries;
+		Containers.back().Bytes += bytes;
+		Containers.back().LookupKeys += lookup_keys;
 	}
 
-	else
+	/*The vectors added one after another under the same name are summed*/
+	template <typename T, typename A> void Add(const std::string& container, const vector<T, A>& column)
 	{
-		if(FirmBSH[ID][0] > 0.0 ){CannotPay(ID);}
-		else
-		{
-			for(unordered_map<int, double >::iterator itr=rOrdersHoH[ID].begin();itr!=rOrdersHoH[ID].end();itr++)
-			{
-				rzDemandVectorH[(*itr).first]-= rOrdersHoH[ID][(*itr).first];
-				FirmBSH[(*itr).first][0]-= ProfitToSalesH[(*itr).first]*rOrdersHoH[ID][(*itr).first];
-				rOrdersHoH[ID][(*itr).first] = 0;
-				AccfInventoryHoH[ID][(*itr).first] = 0;
-				AccsInventoryHoH[ID][InPutFirmHoH[ID][(*itr).first][1]]= 0;
-				GROrdersH[ID]= 0;
-			}
-		}
+		Add(container, column.size(), column.capacity()*sizeof(T));
 	}
-}
-
-
-void FirmBS_Update(int ID)
-{
-	double paid_capital = 0;
-	double total_amortization = 0;
-	double profit = rzDemandVectorH[ID] - ExpensesH[ID];
-	bool TotallyPaid;
-	for(unordered_map<int, unordered_map<int, vector < double > > >::iterator  itr1=CurrentLoansHoH[ID].begin(); itr1!=CurrentLoansHoH[ID].end();itr1++)
-    {
-		/*
-		 * Update of the deposit in each bank account based on the profit only (not final update)
-		*/
-		FirmBankHoH[ID][(*itr1).first][1]=FirmBSH[ID][0]/FirmBankHoH[ID].size();
-
-    	for(unordered_map<int, vector < double > >::iterator  itr2=CurrentLoansHoH[ID][(*itr1).first].begin(); itr2!=CurrentLoansHoH[ID][(*itr1).first].end();itr2++)
-    	{
-    		TotallyPaid = 0;
-    		if((CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] == 0) or (CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] == 2))
-    		{
-    			if(FirmBankHoH[ID][(*itr1).first][1] >= CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][2])
-    			{
-        			/*
-        			 * The current loan level update
-        			*/
-    				CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] = 0;
-        			double paid_capital_bank = CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][0]/LoanMaturity;
-        			FirmBankHoH[ID][(*itr1).first][0]-=paid_capital_bank;
-        			paid_capital+=paid_capital_bank;
-        			/*
-        			 * Deposits after paying loans
-        			*/
-        			FirmBankHoH[ID][(*itr1).first][1]-= CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][2];
-        			total_amortization+=CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][2];
-        			CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][3]++;
-        			if(CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][3] >= LoanMaturity)
-        			{
-        				CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] = 1;
-        				TotallyPaid = 1;
-        			}
-    			}
-
-    			else
-    			{
-    				CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][4]++;
-    				if((CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][4] >= LimitToDefault) and (CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][6] == 0))
-    				{
-        				double NPL = CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][0];
-        				NPLHoH[ID][(*itr1).first]+=NPL;
-        				BankNPLH[(*itr1).first][0] += NPL/CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][0];
-        				BankNPLH[(*itr1).first][1]++;
-        				CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] = 2;
-    				}
-    			}
-    		}
-    		if (TotallyPaid == 0)
-    		{
-        		if((CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] == 0) and (CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][6] == 0))
-        		{
-        			GLoan+=CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][0];
-        		}
-
-        		else if ((CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][5] == 2) and (CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][6] == 0))
-        		{
-        			GNPL+=CurrentLoansHoH[ID][(*itr1).first][(*itr2).first][0];
-        		}
-    		}
-    	}
-    }
-	/*
-	 * Final update of the balance sheet
-	 * Deposit / Loans / Equity
-	*/
 
-	FirmBSH[ID][0]-= total_amortization;
-	FirmBSH[ID][2]-= paid_capital;
-	FirmBSH[ID][3]= FirmBSH[ID][0]+FirmBSH[ID][1] - FirmBSH[ID][2] - FirmBSH[ID][4];
-	GDeposit+=rzDemandVectorH[ID]*ProfitToSalesH[ID] - total_amortization;
-	GEquity+=FirmBSH[ID][3];
-}
+	template <typename T> void Add(const std::string& container, const set<T>& values)
+	{
+		Add(container, values.size(), values.size()*(sizeof(T) + 4*sizeof(void*))); //A node of the tree: the value, three links and the color
+	}
 
-void OneStepSimulation()
-{
-	/*
-	 * This function calls all the previous functions.
-	 * It represents a simulation across all firms in one step: from t to t+1
-	*/
-	ValueGDP = 0;
-	Desired_Goods();
-	for (unordered_map<int,int>::iterator itr=ListofFirmsH.begin(); itr!=ListofFirmsH.end();itr++)
+	/*A map from the IDs of the banks to their vectors; the keys which are not in banks were created by a lookup*/
+	template <typename T> void Add(const std::string& container, const unordered_map<int, vector<T> >& map, const vector<int>& banks)
 	{
-		if (((InactiveFirms.find((*itr).first) != InactiveFirms.end())==0))
+		uint64_t bytes = map.bucket_count()*sizeof(void*);
+		uint64_t lookup_keys = 0;
+		for (typename unordered_map<int, vector<T> >::const_iterator itr = map.begin(); itr != map.end(); ++itr)
 		{
-			ProductionInoue18((*itr).first);
-			Trading((*itr).first);
+			bytes += sizeof(void*) + sizeof(*itr) + itr->second.capacity()*sizeof(T);
+			if (std::binary_search(banks.begin(), banks.end(), itr->first) == 0){lookup_keys++;}
 		}
+		Add(container, map.size(), bytes, lookup_keys);
 	}
 
-	for (unordered_map<int,int>::iterator itr=ListofFirmsH.begin(); itr!=ListofFirmsH.end();itr++)
+	uint64_t Total() const
 	{
-		if (((InactiveFirms.find((*itr).first) != InactiveFirms.end())==0))
-		{
-			if(ShortLoans==1){NeedLoan((*itr).first);}
-			if(WithPayment==1){Payment((*itr).first);}
-			FirmBS_Update((*itr).first);
+		uint64_t total = 0;
+		for (size_t k = 0; k < Containers.size(); k++){total += Containers[k].Bytes;}
+		return total;
+	}
 
-			/*
-			 * A loop to erase paid loans
-			*/
-			for(unordered_map<int, unordered_map<int, vector < double > > >::iterator  itr1=CurrentLoansHoH[(*itr).first].begin(); itr1!=CurrentLoansHoH[(*itr).first].end();itr1++)
-		    {
-				set<int> key;
-				unordered_map<int, vector < double > >::iterator  itr2=CurrentLoansHoH[(*itr).first][(*itr1).first].begin();
-		    	while(itr2!=CurrentLoansHoH[(*itr).first][(*itr1).first].end())
-				{
-		    		if(CurrentLoansHoH[(*itr).first][(*itr1).first][(*itr2).first][5] == 1){key.insert((*itr2).first);}
-		    		itr2++;
-		    	}
-		    	for(set<int>::iterator itKey = key.begin(); itKey != key.end(); itKey++)
-		    	{
-		    		CurrentLoansHoH[(*itr).first][(*itr1).first].erase(*itKey);
-		    	}
-		    }
+	/*One line per container, then the total and the resident memory of the process*/
+	void Write(ostream& file, const std::string& step) const
+	{
+		for (size_t k = 0; k < Containers.size(); k++)
+		{
+			const Entry& entry = Containers[k];
+			file << step << '\t' << entry.Container << '\t' << entry.Entries << '\t' << entry.Bytes << '\t' << entry.LookupKeys << '\n';
+			cout << "memory ; " << step << " ; " << entry.Container << " ; " << entry.Entries << " ; " << entry.Bytes << " bytes";
+			if (entry.LookupKeys > 0){cout << " ; " << entry.LookupKeys << " keys created by lookup";}
+			cout << '\n';
 		}
+		uint64_t current, peak;
+		ResidentMemory(current, peak);
+		file << step << "\tTotal\t\t" << Total() << "\t0\n";
+		file << step << "\tResident\t\t" << current << "\t0\n";
+		cout << "memory ; " << step << " ; total ; " << Total() << " bytes ; resident ; " << current << " bytes" << endl;
 	}
+};
 
-	double min = 0.0;
-	double max = 0.0;
-	for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+void Network::Memory(MemoryReport& report) const
+{
+	report.Add("FirmIDs", FirmIDs);
+	for (const CSRLinks* links : {&OutLinks, &InLinks})
 	{
-		double recover = FirmBSH[*it][0]/(ProductionIniH[*it]*DamageMagnitude*(1-1/LTLoanMaturity));
-		if (min < recover){min = recover;}
-		if (max > recover){max = recover;}
+		std::string name = (links == &OutLinks) ? "OutLinks" : "InLinks";
+		report.Add(name, links->Start);
+		report.Add(name, links->Firm);
+		report.Add(name, links->Weight);
+		report.Add(name, links->InvWeight);
+		report.Add(name, links->Sector);
+		report.Add(name, links->Twin);
 	}
-
-	for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
+	report.Add("LinkS", LinkS);
+	report.Add("LinkC", LinkC);
+	for (const Column<double>* column : {&Profile.Pini, &Profile.C, &Profile.ProfitToSales, &Profile.TotalOutput, &Profile.TotalInput, &Profile.Deposit, &Profile.OA,
+			&Profile.Loan, &Profile.Equity, &Profile.OL, &Profile.Clusters, &Profile.Knn})
 	{
-		double recover = FirmBSH[*it][0]/(ProductionIniH[*it]*DamageMagnitude*(1-1/LTLoanMaturity));
-		RecoveryH[*it] = Scale(min,max,recover);
+		report.Add("Profile", *column);
 	}
-
-	for (unordered_map<int, unordered_map<int, vector<double>>>::iterator itC=fInventoryHoH.begin(); itC!=fInventoryHoH.end();itC++)
+	for (const Column<int>* column : {&Profile.IOSector, &Profile.Sector, &Profile.Location, &Profile.Community})
 	{
-		fUsedInventoryH[(*itC).first] = 0;
-        for(unordered_map<int, vector<double>>::iterator itS=fInventoryHoH[(*itC).first].begin(); itS!=fInventoryHoH[(*itC).first].end();itS++)
-        {
-        	/*
-        	 * Update the inventory at the firm level.
-        	 * Update the inventory at the sector level.
-        	*/
-
-        	double used = InPutFirmHoH[(*itC).first][(*itS).first][0]*CurrentProductionH[(*itC).first]/ProductionIniH[(*itC).first];
-        	fInventoryHoH[(*itC).first][(*itS).first][0]=fInventoryHoH[(*itC).first][(*itS).first][0]-used + AccfInventoryHoH[(*itC).first][(*itS).first];
-        	sInventoryHoH[(*itC).first][InPutFirmHoH[(*itC).first][(*itS).first][1]]=sInventoryHoH[(*itC).first][InPutFirmHoH[(*itC).first][(*itS).first][1]]-used + AccsInventoryHoH[(*itC).first][InPutFirmHoH[(*itC).first][(*itS).first][1]];
-        	fUsedInventoryH[(*itC).first]+=used;
-        	AccfInventoryHoH[(*itC).first][(*itS).first] = 0;
-        	AccsInventoryHoH[(*itC).first][InPutFirmHoH[(*itC).first][(*itS).first][1]] = 0;
-        }
+		report.Add("Profile", *column);
 	}
-
-	for (unordered_map<int, double>::iterator itr=rzDemandVectorH.begin(); itr!=rzDemandVectorH.end();itr++)
+	report.Add("Profile", Profile.Active);
+	report.Add("Sectors", Sectors.Start);
+	report.Add("Sectors", Sectors.Sector);
+	report.Add("Sectors", Sectors.Slot);
+	report.Add("Sectors", Sectors.Aij);
+	report.Add("Accounts", Accounts.Start);
+	report.Add("Accounts", Accounts.Bank);
+	report.Add("Accounts", Accounts.Balance);
+	report.Add("Accounts", Accounts.Banks);
+	for (const FirmGroups* groups : {&LocationFirms, &SectorFirms, &CommunityFirms})
 	{
-		double val = rzDemandVectorH[(*itr).first] - fUsedInventoryH[(*itr).first];
-		ValueAddedVectorH[(*itr).first].push_back(val);
-		ValueGDP+=val;
+		std::string name = (groups == &LocationFirms) ? "LocationFirms" : ((groups == &SectorFirms) ? "SectorFirms" : "CommunityFirms");
+		report.Add(name, groups->Key);
+		report.Add(name, groups->Start);
+		report.Add(name, groups->Firm);
 	}
-	RateNPLH.push_back(GNPL/(GLoan+GNPL));
-	GDP.push_back(ValueGDP);
-	NPLH.push_back(GNPL);
-	DepositH.push_back(GDeposit);
-	GDeposit = 0;
-	LoanH.push_back(GLoan);
-	GLoan = 0;
-	GNPL = 0;
-	EquityH.push_back(GEquity);
-	GEquity = 0;
-
 }
 
-void Simulate()
+void Simulation::Memory(MemoryReport& report) const
 {
-	/*
-	 * This function is the whole system simulation.
-	 * It calls only the procedure OneStepSimulation() over the simulation time.
-	*/
+	for (const Column<double>* column : {&Firm.Pact, &Firm.dOrders, &Firm.GROrders, &Firm.rcDemand, &Firm.rzDemand, &Firm.fUsedInventory, &Firm.Delta, &Firm.Recovery,
+			&Firm.LTLoans, &Firm.Deposit, &Firm.Loan, &Firm.Equity, &Firm.Expenses})
+	{
+		report.Add("Firm", *column);
+	}
+	for (const Column<int>* column : {&Firm.Days, &Firm.LoanFlag, &Firm.NoLoans})
+	{
+		report.Add("Firm", *column);
+	}
+	report.Add("Firm", Firm.Damaged);
+	report.Add("ValueAdded", ValueAdded.Current);
+	report.Add("ValueAdded", ValueAdded.Values);
+	report.Add("ValueAdded", ValueAdded.Days);
+	report.Add("Residual", Residual);
+	report.Add("dOrdersV", dOrdersV);
+	report.Add("rOrdersV", rOrdersV);
+	report.Add("rReturnedV", rReturnedV);
+	report.Add("rcDemandFirmLevelV", rcDemandFirmLevelV);
+	report.Add("fInventoryV", fInventoryV);
+	report.Add("AccfInventoryV", AccfInventoryV);
+	report.Add("Stock", Stock.Inventory);
+	report.Add("Stock", Stock.AccInventory);
+	for (const Column<char>* column : {&Frontier.OrdersInput, &Frontier.OrdersChanged, &Frontier.DemandChanged, &Frontier.ProductionInput, &Frontier.ProductionChanged})
+	{
+		report.Add("Frontier", *column);
+	}
+	report.Add("Frontier", Frontier.LastRzDemand);
+	report.Add("Frontier", Frontier.Sales);
+	report.Add("Frontier", Frontier.Delivered);
+	report.Add("DamagedFirmsH", DamagedFirmsH);
+	for (const vector<double>* series : {&GDP, &NPLH, &DepositH, &LoanH, &EquityH, &RateNPLH})
+	{
+		report.Add("Series", *series);
+	}
+	report.Add("Loans.Pool", Loans.Pool);
+	report.Add("Loans.Accounts", Loans.Head);
+	report.Add("Loans.Accounts", Loans.Tail);
+	report.Add("Loans.Accounts", Loans.Opened);
+	report.Add("Loans.Accounts", Loans.Balance);
+	report.Add("Loans.Accounts", Loans.PayByLoan);
+	report.Add("Loans.Accounts", Loans.NPL);
+	report.Add("Finance", Finance);
+	for (size_t b = 0; b < Finance.size(); b++)
+	{
+		report.Add("Finance", Finance[b].Requests);
+		report.Add("Finance", Finance[b].Repaid);
+		report.Add("Finance", Finance[b].BankNPL);
+	}
+	report.Add("BankNPLH", BankNPLH, Accounts.Banks);
+	report.Add("BankLoanDepositH", BankLoanDepositH, Accounts.Banks);
+	report.Add("Timing", Timing);
+	report.Add("Trace", Trace);
+}
 
-	while(t < SimTime)
+/*This procedure reports the memory of the network and of one replication, simulated until the last step of the report*/
+void RunMemoryReport(const Network& network, const vector<int>& steps, uint64_t seed)
+{
+	ofstream file(MemoryResults);
+	if (!file){throw runtime_error(MemoryResults + ": cannot write the memory report");}
+	file << "Step\tContainer\tEntries\tBytes\tLookupKeys\n";
+	MemoryReport load;
+	network.Memory(load);
+	load.Write(file, "load");
+
+	CheckpointEvery = 0;
+	Simulation snapshot(network, -1, seed);
+	snapshot.Initial_Data();
+	Simulation simulation(snapshot, std::max(0, RerunReplication));
+	simulation.Draw_Inventory();
+	int last = 0;
+	for (size_t k = 0; k < steps.size(); k++){last = std::max(last, std::min(steps[k], SimTime));}
+	while (1)
 	{
-		auto start = std::chrono::high_resolution_clock::now();
-		if(t==1)
+		if ((simulation.t == 0) or (std::find(steps.begin(), steps.end(), simulation.t) != steps.end()))
 		{
-			DamagedFirms();
-			disaster = 1;
-			if(LTLoansModel==1)
-			{
-				for(set<int>::iterator it = DamagedFirmsH.begin(); it != DamagedFirmsH.end(); it++)
-				{
-
-					double TotalLoanDde = ProductionIniH[*it]*DamageMagnitude;
-
-					for(unordered_map<int, vector < double > >::iterator  itr=FirmBankHoH[*it].begin(); itr!=FirmBankHoH[*it].end();itr++)
-					{
-					    double ln = TotalLoanDde/FirmBankHoH[*it].size();
-					    double rate = 0.04;
-					    double periodic = ln*rate/(1-pow(1+rate,-LTLoanMaturity));
-
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(ln); //The amount of loans
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(rate); //The applied interest rate
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(periodic); //The amount paid monthly
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(0); //Number of paid monthly
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(0); //Count periods of non-payment before declaring loan default
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(0); //Index for loan situation; 0: healthy loan with payment; 1: paid loan 2: defaulted loan
-					    CurrentLoansHoH[*it][(*itr).first][LoanKeyHoH[*it][(*itr).first]].push_back(1); //0: short-term loan; 1: long-term loan
-
-					    LoanKeyHoH[*it][(*itr).first]++;
-					    FirmBankHoH[*it][(*itr).first][0]+=ln;
-
-					}
-				}
-			}
+			MemoryReport report;
+			simulation.Memory(report);
+			report.Write(file, to_string(simulation.t));
 		}
-		OneStepSimulation();
-		cout << "step ; " << t << " ; " << GDP[GDP.size()-1] << endl;
-		auto finish = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double> elapsed = finish - start;
-		cout << "Elapsed time: " << elapsed.count() << " s\n";
-		++t;
+		if (simulation.t >= last){break;}
+		simulation.Step();
 	}
-	GvtSupportH.push_back(GvtSupport);
+	file.close();
+	if (!file){throw runtime_error(MemoryResults + ": cannot write the memory report");}
 }
 
 /*
@@ -1377,209 +4675,163 @@ void Simulate()
 */
 
 
-int main()
+int main(int argc, char* argv[])
 {
-	srand (time(NULL));
-	for (int sim = 0 ; sim < GlobalSim ; sim++)
-	{
-		Initial_Data();
-		Simulate();
-
-		for(unordered_map<int, unordered_map<int, vector < double > > >::iterator itr1 = FirmBankHoH.begin(); itr1 != FirmBankHoH.end() ; itr1++)
-		{
-			for(unordered_map<int, vector < double > >::iterator itr2 = FirmBankHoH[(*itr1).first].begin();itr2 != FirmBankHoH[(*itr1).first].end(); itr2++)
-			{
-				BankLoanDepositH[(*itr2).first][0]+=FirmBankHoH[(*itr1).first][(*itr2).first][0];
-				BankLoanDepositH[(*itr2).first][1]+=FirmBankHoH[(*itr1).first][(*itr2).first][1];
-			}
-		}
-
-		ofstream gdp_data;
-		std::string path = "Results/GDP.txt";
-		gdp_data.open(path);
-	    for (int i=0; i<GDP.size(); ++i)
-		{
-			gdp_data << GDP[i] << '\n'  ;
-			SimGDPH[sim].push_back(GDP[i]);
-		}
-		gdp_data.close();
+	/*
+	 * ABM_Disasters compile: parse the input files and write the network cache only
+	*/
+	bool compile = (argc > 1) and (std::string(argv[1]) == "compile");
 
-		ofstream npl_data;
-		std::string npl_path = "Results/NPL.txt";
-		npl_data.open(npl_path);
-	    for (int i=0; i<NPLH.size(); ++i)
-		{
-	    	npl_data << NPLH[i] << '\n'  ;
-	    	SimNPLH[sim].push_back(NPLH[i]);
-		}
-	    npl_data.close();
+	/*
+	 * ABM_Disasters resume: each replication continues from its checkpoint, if there is one
+	*/
+	bool resume = (argc > 1) and (std::string(argv[1]) == "resume");
 
-		ofstream deposit_data;
-		std::string deposit_path = "Results/Deposit.txt";
-		deposit_data.open(deposit_path);
-	    for (int i=0; i<DepositH.size(); ++i)
-		{
-	    	deposit_data << DepositH[i] << '\n'  ;
-	    	SimDepositH[sim].push_back(DepositH[i]);
-		}
-	    deposit_data.close();
+	/*
+	 * ABM_Disasters sweep [file]: simulate GlobalSim replications of each parameter set of the file (SweepFile by default)
+	*/
+	bool sweep = (argc > 1) and (std::string(argv[1]) == "sweep");
 
-		ofstream equity_data;
-		std::string equity_path = "Results/Equity.txt";
-		equity_data.open(equity_path);
-	    for (int i=0; i<EquityH.size(); ++i)
-		{
-	    	equity_data << EquityH[i] << '\n'  ;
-		}
-	    equity_data.close();
+	/*
+	 * ABM_Disasters calibrate [file]: score each parameter set of the file (SweepFile by default) against the observed IIP of CalibrationTarget
+	*/
+	bool calibrate = (argc > 1) and (std::string(argv[1]) == "calibrate");
 
-		ofstream loan_data;
-		std::string loan_path = "Results/Loan.txt";
-		loan_data.open(loan_path);
-	    for (int i=0; i<LoanH.size(); ++i)
-		{
-	    	loan_data << LoanH[i] << '\n'  ;
-	    	SimLoansH[sim].push_back(LoanH[i]);
-		}
-	    loan_data.close();
+	/*
+	 * ABM_Disasters memory [steps...]: report the memory of the containers of the network and of one replication at the steps (MemorySteps by default)
+	*/
+	bool memory = (argc > 1) and (std::string(argv[1]) == "memory");
 
-		ofstream rate_data;
-		std::string rate_path = "Results/RateNPL.txt";
-		rate_data.open(rate_path);
-	    for (int i=0; i<RateNPLH.size(); ++i)
+	/*
+	 * ABM_Disasters generate firms [directory]: write the input files of a synthetic economy in the directory (BenchmarkDirectory + firms by default)
+	 * ABM_Disasters benchmark [firms...]: time the load and the steps of the synthetic economies of each size (BenchmarkSizes by default)
+	*/
+	bool generate = (argc > 1) and (std::string(argv[1]) == "generate");
+	bool benchmark = (argc > 1) and (std::string(argv[1]) == "benchmark");
+	if (generate or benchmark)
+	{
+		try
 		{
-	    	rate_data << RateNPLH[i] << '\n'  ;
-	    	SimNPLRateH[sim].push_back(RateNPLH[i]);
+			vector<int> sizes;
+			for (int a = 2; a < (generate ? std::min(argc, 3) : argc); a++)
+			{
+				char* end;
+				long firms = strtol(argv[a], &end, 10);
+				if ((*end != 0) or (firms < 2) or (firms > std::numeric_limits<int>::max())){throw runtime_error(std::string(argv[a]) + ": not a number of firms");}
+				sizes.push_back(firms);
+			}
+			if (generate)
+			{
+				if (sizes.empty()){throw runtime_error("generate: the number of firms is missing");}
+				std::string directory = (argc > 3) ? argv[3] : BenchmarkDirectory + to_string(sizes[0]);
+				if ((directory.back() != '/') and (directory.back() != '\\')){directory += '/';}
+				GenerateEconomy(sizes[0], directory);
+			}
+			else {RunBenchmark(sizes.empty() ? BenchmarkSizes : sizes, (MasterSeed != 0) ? MasterSeed : SyntheticSeed);}
 		}
-	    rate_data.close();
-
-		ofstream damage_data;
-		std::string damage_path = "Results/DamagedFirms.txt";
-		damage_data.open(damage_path);
-	    for (set <int>::iterator itr = DamagedFirmsH.begin(); itr != DamagedFirmsH.end(); ++itr)
+		catch (const std::exception& error)
 		{
-	    	damage_data << *itr << '\n' ;
+			cerr << error.what() << endl;
+			return 1;
 		}
-	    damage_data.close();
-
-		ofstream degree_data;
-		std::string degree_path = "Results/FirmLevelData.txt";
-		degree_data.open(degree_path);
-
-		Clearing();
+		return 0;
 	}
 
-	ofstream full_gdp;
-	std::string path = "Results/FullGDP.txt";
-	full_gdp.open(path);
-	for(int i = 0; i < SimTime; i++)
+	Network network;
+	try
 	{
-		for (unordered_map<int, vector<double> >::iterator it = SimGDPH.begin(); it!=SimGDPH.end();++it)
+		if (compile or NetworkCache.empty() or (network.LoadCache(NetworkCache) == 0))
 		{
-	    	full_gdp << SimGDPH[(*it).first][i] << '\t'  ;
+			network.Load();
+			if (NetworkCache.empty() == 0)
+			{
+				try {network.SaveCache(NetworkCache);}
+				catch (const std::exception& error)
+				{
+					if (compile){throw;}
+					cerr << error.what() << endl;
+				}
+			}
 		}
-    	full_gdp << '\n';
 	}
-
-    full_gdp.close();
-
-	ofstream full_loan;
-	path = "Results/FullLoan.txt";
-	full_loan.open(path);
-	for(int i = 0; i < SimTime; i++)
+	catch (const std::exception& error)
 	{
-		for (unordered_map<int, vector<double> >::iterator it = SimLoansH.begin(); it!=SimLoansH.end();++it)
-		{
-			full_loan << SimLoansH[(*it).first][i] << '\t'  ;
-		}
-		full_loan << '\n';
+		cerr << error.what() << endl;
+		return 1;
 	}
-
-	full_loan.close();
-
-	ofstream full_npl;
-	path = "Results/FullNPL.txt";
-	full_npl.open(path);
-	for(int i = 0; i < SimTime; i++)
+	if (compile)
 	{
-		for (unordered_map<int, vector<double> >::iterator it = SimNPLH.begin(); it!=SimNPLH.end();++it)
-		{
-			full_npl << SimNPLH[(*it).first][i] << '\t'  ;
-		}
-		full_npl << '\n';
+		cout << "Network cache ; " << NetworkCache << " ; " << network.FirmIDs.size() << " firms ; " << network.OutLinks.Firm.size() << " links" << endl;
+		return 0;
 	}
 
-	full_npl.close();
-
-	ofstream full_nplrate;
-	path = "Results/FullNPLRate.txt";
-	full_nplrate.open(path);
-	for(int i = 0; i < SimTime; i++)
+	vector<int> replications;
+	if (RerunReplication >= 0){replications.push_back(RerunReplication);}
+	else
 	{
-		for (unordered_map<int, vector<double> >::iterator it = SimNPLRateH.begin(); it!=SimNPLRateH.end();++it)
-		{
-			full_nplrate << SimNPLRateH[(*it).first][i] << '\t'  ;
-		}
-		full_nplrate << '\n';
+		for (int sim = 0 ; sim < GlobalSim ; sim++){replications.push_back(sim);}
 	}
 
-	full_nplrate.close();
-
-	ofstream full_deposit;
-	path = "Results/FullDeposit.txt";
-	full_deposit.open(path);
-	for(int i = 0; i < SimTime; i++)
+	/*Without a master seed, a resumed run takes the seed of the checkpoints*/
+	uint64_t seed = MasterSeed;
+	for (size_t k = 0; resume and (seed == 0) and (k < replications.size()); k++)
 	{
-		for (unordered_map<int, vector<double> >::iterator it = SimDepositH.begin(); it!=SimDepositH.end();++it)
-		{
-			full_deposit << SimDepositH[(*it).first][i] << '\t'  ;
-		}
-		full_deposit << '\n';
+		CheckpointHeader header;
+		if (ReadCheckpointHeader(CheckpointPath(replications[k]), header)){seed = header.Seed;}
 	}
+	if (seed == 0){seed = time(NULL);}
+	cout << "Master seed ; " << seed << endl;
 
-	full_deposit.close();
-
-	ofstream npl;
-	path = "Results/FinalNPL.txt";
-	npl.open(path);
-	for (unordered_map<int, vector<double> >::iterator it = SimLoansH.begin(); it!=SimLoansH.end();++it)
+	if (memory)
 	{
-		double sum_loans = 0;
-		double sum_npl = 0;
-		for(int i = 0; i < SimTime; i++)
+		try
 		{
-			sum_loans+=SimLoansH[(*it).first][i];
-			sum_npl+=SimNPLH[(*it).first][i];
+			vector<int> steps;
+			for (int a = 2; a < argc; a++)
+			{
+				char* end;
+				long step = strtol(argv[a], &end, 10);
+				if ((*end != 0) or (step < 0) or (step > std::numeric_limits<int>::max())){throw runtime_error(std::string(argv[a]) + ": not a step");}
+				steps.push_back(step);
+			}
+			RunMemoryReport(network, steps.empty() ? MemorySteps : steps, seed);
 		}
-
-		npl << sum_npl/(sum_npl+sum_loans) << '\n'  ;
+		catch (const std::exception& error)
+		{
+			cerr << error.what() << endl;
+			return 1;
+		}
+		return 0;
 	}
-	npl.close();
 
-	ofstream liquidity;
-	path = "Results/FinalLiquidity.txt";
-	liquidity.open(path);
-	for (unordered_map<int, vector<double> >::iterator it = SimLoansH.begin(); it!=SimLoansH.end();++it)
+	if (sweep or calibrate)
 	{
-		double sum_loans = 0;
-		double sum_dep = 0;
-		for(int i = 0; i < SimTime; i++)
+		try
 		{
-			sum_loans+=SimLoansH[(*it).first][i];
-			sum_dep+=SimDepositH[(*it).first][i];
+			ParameterSweep sets = ReadSweep((argc > 2) ? argv[2] : SweepFile);
+			CheckpointEvery = 0; //The checkpoints and the panels are named by replication only
+			ValueAddedHistory = 0;
+			if (sweep){RunSweep(network, sets, seed);}
+			else {RunCalibration(network, sets, ReadCalibrationTarget(CalibrationTarget), seed);}
 		}
-
-		liquidity << sum_loans/sum_dep << '\n'  ;
+		catch (const std::exception& error)
+		{
+			cerr << error.what() << endl;
+			return 1;
+		}
+		return 0;
 	}
-	liquidity.close();
 
-	ofstream support;
-	path = "Results/FinalGvtSupport.txt";
-	support.open(path);
-	for (int it = 0; it < GvtSupportH.size(); ++it)
+	try
+	{
+		ResultsWriter writer(seed);
+		RunReplications(network, replications, writer, seed, resume);
+		writer.Close();
+	}
+	catch (const std::exception& error)
 	{
-		support << GvtSupportH[it] << '\n'  ;
+		cerr << error.what() << endl;
+		return 1;
 	}
-	support.close();
 	return 0;
 }